@@ -19,8 +19,8 @@ char iv[]  = "1234567890123456";
 aes_helper ah;
 ah.set_key(key, iv);
 
-//std::string p1 = string_to_utf8("ʾֻ ha hah ha");
-std::string p1 = ("ʾֻ ha hah ha");
+//std::string p1 = string_to_utf8("首先在您的示例中只是 ha hah ha");
+std::string p1 = ("首先在您的示例中只是 ha hah ha");
 
 auto ret = ah.encrypt_cbc((uint8_t*)p1.data(), p1.size() + 1, aes_helper::PaddingMode::Zeros);
 
@@ -50,7 +50,7 @@ public:
 		//PKCS5Padding
 	};
 
-	//16ֽ(128λ)Կ,16ֽ(128λ)iv, ivΪգ ivԿͬ
+	//16字节(128位)密钥,16字节(128位)iv, 如果iv为空， 则iv和密钥相同
 	void set_key(const char* szkey, const char* sziv = nullptr)
 	{
 		for (int i = 0; i < key_size; i++)
@@ -0,0 +1,130 @@
+/****************************************************************************
+
+Git <https://github.com/sniper00/MoonNetLua>
+E-Mail <hanyongtao@live.com>
+Copyright (c) 2015-2016 moon
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+
+****************************************************************************/
+
+#pragma once
+#include <cstdint>
+#include <atomic>
+#include <array>
+
+namespace moon
+{
+	//按数量级分桶的直方图, 用于统计耗时。 只能有一个线程写入, 其它线程可以同时读取
+	//每个 2 的幂区间分为 [2^b, 1.5*2^b) 和 [1.5*2^b, 2^(b+1)) 两个桶, 百分位的误差不超过 50%
+	class Histogram
+	{
+	public:
+		constexpr static uint32_t BUCKET_NUM = 128;
+
+		Histogram()
+			:m_Count(0), m_Sum(0), m_Max(0)
+		{
+			for (auto& b : m_Buckets)
+			{
+				b.store(0, std::memory_order_relaxed);
+			}
+		}
+
+		void Add(uint64_t v)
+		{
+			auto& b = m_Buckets[Bucket(v)];
+			//只有写入线程会修改, 不需要原子的加法
+			b.store(b.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			m_Count.store(m_Count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			m_Sum.store(m_Sum.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+			if (v > m_Max.load(std::memory_order_relaxed))
+			{
+				m_Max.store(v, std::memory_order_relaxed);
+			}
+		}
+
+		uint64_t Count() const
+		{
+			return m_Count.load(std::memory_order_relaxed);
+		}
+
+		uint64_t Sum() const
+		{
+			return m_Sum.load(std::memory_order_relaxed);
+		}
+
+		uint64_t Max() const
+		{
+			return m_Max.load(std::memory_order_relaxed);
+		}
+
+		/**
+		* 获取百分位的值, 返回所在桶的上界(不超过最大值)
+		*
+		* @p 0-100
+		*/
+		uint64_t Percentile(double p) const
+		{
+			uint64_t total = 0;
+			std::array<uint64_t, BUCKET_NUM> counts;
+			for (uint32_t i = 0; i < BUCKET_NUM; i++)
+			{
+				counts[i] = m_Buckets[i].load(std::memory_order_relaxed);
+				total += counts[i];
+			}
+
+			if (0 == total)
+				return 0;
+
+			auto rank = static_cast<uint64_t>(total * p / 100.0);
+			if (rank >= total)
+			{
+				rank = total - 1;
+			}
+
+			auto max = Max();
+			uint64_t n = 0;
+			for (uint32_t i = 0; i < BUCKET_NUM; i++)
+			{
+				n += counts[i];
+				if (n > rank)
+				{
+					auto v = UpperBound(i);
+					return (v < max) ? v : max;
+				}
+			}
+			return max;
+		}
+
+	private:
+		static uint32_t Bucket(uint64_t v)
+		{
+			if (v < 2)
+				return 0;
+			uint32_t b = 63;
+			while (0 == (v >> b))
+			{
+				b--;
+			}
+			return b * 2 + static_cast<uint32_t>((v >> (b - 1)) & 1);
+		}
+
+		static uint64_t UpperBound(uint32_t i)
+		{
+			uint32_t b = i / 2;
+			if (0 == b)
+				return 1;
+			if (i % 2)
+			{
+				return (b == 63) ? UINT64_MAX : (uint64_t(1) << (b + 1)) - 1;
+			}
+			return (uint64_t(3) << (b - 1)) - 1;
+		}
+
+	private:
+		std::array<std::atomic<uint64_t>, BUCKET_NUM>	m_Buckets;
+		std::atomic<uint64_t>									m_Count;
+		std::atomic<uint64_t>									m_Sum;
+		std::atomic<uint64_t>									m_Max;
+	};
+};
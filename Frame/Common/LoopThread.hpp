@@ -12,6 +12,9 @@ Licensed under the MIT License <http://opensource.org/licenses/MIT>.
 #include <chrono>
 #include <thread>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
 
 namespace moon
 {
@@ -19,7 +22,7 @@ namespace moon
 	{
 	public:
 		LoopThread()
-			:_Interval(1000), _bStop(false)
+			:_Interval(1000), _bStop(false), _bNotified(false)
 		{
 
 		}
@@ -32,7 +35,7 @@ namespace moon
 		LoopThread(const LoopThread& t) = delete;
 		LoopThread& operator=(const LoopThread& t) = delete;
 
-		//ѭ 
+		//设置循环间隔 毫秒
 		void Interval(uint32_t interval)
 		{
 			_Interval = interval;
@@ -45,34 +48,78 @@ namespace moon
 
 		void Stop()
 		{
-			_bStop = true;
-			_Thread.join();
+			{
+				std::lock_guard<std::mutex> lck(_Mutex);
+				_bStop = true;
+			}
+			_Cond.notify_one();
+			if (_Thread.joinable())
+			{
+				_Thread.join();
+			}
+		}
+
+		//Run 之后, Stop 之前返回 true
+		bool IsRunning()
+		{
+			return _Thread.joinable() && !_bStop;
+		}
+
+		//立即唤醒循环线程并调用 onNotify, 不需要等到下一次 onUpdate。 这个函数是线程安全的
+		void Notify()
+		{
+			{
+				std::lock_guard<std::mutex> lck(_Mutex);
+				if (_bNotified)
+					return;
+				_bNotified = true;
+			}
+			_Cond.notify_one();
 		}
 
 		std::function<void(uint32_t)> onUpdate;
+
+		std::function<void()> onNotify;
 	private:
 		void loop()
 		{
-			uint64_t prew = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
-			uint32_t prevSleepTime = 0;
+			using clock = std::chrono::steady_clock;
+
+			auto prev = clock::now();
+			auto next = prev + std::chrono::milliseconds(_Interval);
 			while (!_bStop)
 			{
-				uint64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
-				uint32_t diff = (now - prew) & 0xFFFFFFFF;
-				prew = now;
+				auto now = clock::now();
+				if (now >= next)
+				{
+					uint32_t diff = (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(now - prev).count();
+					prev = now;
+
+					if (onUpdate != nullptr)
+					{
+						onUpdate(diff);
+					}
+
+					//保持固定的间隔，落后太多时不再追赶
+					next += std::chrono::milliseconds(_Interval);
+					if (next <= now)
+					{
+						next = now + std::chrono::milliseconds(_Interval);
+					}
+				}
 
-				if (onUpdate != nullptr)
+				bool notified = false;
 				{
-					onUpdate(diff);
+					std::unique_lock<std::mutex> lck(_Mutex);
+					_Cond.wait_until(lck, next, [this] {return _bNotified || _bStop; });
+					notified = _bNotified;
+					_bNotified = false;
 				}
 
-				if (diff <= _Interval + prevSleepTime)
+				if (notified && onNotify != nullptr)
 				{
-					prevSleepTime = _Interval + prevSleepTime - diff;
-					std::this_thread::sleep_for(std::chrono::milliseconds(prevSleepTime));
+					onNotify();
 				}
-				else
-					prevSleepTime = 0;
 			}
 		}
 
@@ -80,5 +127,8 @@ namespace moon
 		uint32_t						_Interval;
 		std::thread					_Thread;
 		std::atomic_bool 			_bStop;
+		std::mutex					_Mutex;
+		std::condition_variable	_Cond;
+		bool							_bNotified;
 	};
 }
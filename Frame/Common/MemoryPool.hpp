@@ -0,0 +1,379 @@
+/****************************************************************************
+
+Git <https://github.com/sniper00/MoonNetLua>
+E-Mail <hanyongtao@live.com>
+Copyright (c) 2015-2016 moon
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+
+****************************************************************************/
+
+#pragma once
+#include <cstdint>
+#include <cstdlib>
+#include <cstddef>
+#include <atomic>
+#include <mutex>
+#include <array>
+#include <vector>
+#include <string>
+#include <new>
+
+namespace moon
+{
+	//按大小分级的内存池。 每个线程有自己的空闲链表，分配和同一线程的释放不需要加锁；
+	//其它线程释放的内存先在释放线程中攒成一批，再一次性交还给分配它的线程
+	class MemoryPool
+	{
+	public:
+		//大于这个值的内存直接使用 malloc
+		constexpr static size_t MAX_BLOCK_SIZE = 65536;
+		//32, 48, 64, 96 ... 49152, 65536
+		constexpr static uint32_t CLASS_NUM = 23;
+		//交还给其它线程时每一批的块数
+		constexpr static uint32_t REMOTE_BATCH_SIZE = 32;
+		//每个线程每一级最多缓存的字节数
+		constexpr static size_t MAX_CACHED_BYTES = 256 * 1024;
+
+		static void* Allocate(size_t size)
+		{
+			auto cache = Local();
+			if (nullptr == cache)
+			{
+				return NewBlock(nullptr, CLASS_NUM, size);
+			}
+
+			//只有所属线程会修改
+			cache->Allocs.store(cache->Allocs.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			if (size > MAX_BLOCK_SIZE)
+			{
+				cache->Mallocs.store(cache->Mallocs.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+				return NewBlock(nullptr, CLASS_NUM, size);
+			}
+
+			auto cls = SizeClass(size);
+
+			if (nullptr == cache->Free[cls])
+			{
+				cache->DrainRemote();
+			}
+
+			auto node = cache->Free[cls];
+			if (nullptr != node)
+			{
+				cache->Free[cls] = node->Next;
+				cache->Count[cls]--;
+				return node;
+			}
+
+			cache->Mallocs.store(cache->Mallocs.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			return NewBlock(cache, cls, ClassSize(cls));
+		}
+
+		static void Deallocate(void* p)
+		{
+			if (nullptr == p)
+				return;
+
+			auto header = static_cast<Header*>(p) - 1;
+			if (header->Class == CLASS_NUM)
+			{
+				std::free(header);
+				return;
+			}
+
+			auto node = static_cast<FreeNode*>(p);
+			auto cache = Local();
+			if (header->Owner == cache)
+			{
+				cache->Push(header->Class, node);
+			}
+			else if (nullptr != cache)
+			{
+				cache->PushRemote(header->Owner, node);
+			}
+			else
+			{
+				//线程正在退出
+				node->Next = nullptr;
+				PushChain(header->Owner, node, node);
+			}
+		}
+
+		/**
+		* 所有线程的统计, key-value形式 : alloc:分配次数;malloc:调用malloc的次数;
+		*/
+		static std::string GetStats()
+		{
+			uint64_t allocs = 0;
+			uint64_t mallocs = 0;
+			auto& reg = GetRegistry();
+			{
+				std::lock_guard<std::mutex> lck(reg.Lock);
+				for (auto& c : reg.All)
+				{
+					allocs += c->Allocs.load(std::memory_order_relaxed);
+					mallocs += c->Mallocs.load(std::memory_order_relaxed);
+				}
+			}
+			return "alloc:" + std::to_string(allocs) + ";malloc:" + std::to_string(mallocs) + ";";
+		}
+
+	private:
+		struct ThreadCache;
+
+		struct alignas(16) Header
+		{
+			ThreadCache*				Owner;
+			uint32_t					Class;
+		};
+
+		struct FreeNode
+		{
+			FreeNode*					Next;
+		};
+
+		struct ThreadCache
+		{
+			struct Batch
+			{
+				ThreadCache*			Owner = nullptr;
+				FreeNode*				Head = nullptr;
+				FreeNode*				Tail = nullptr;
+				uint32_t				Count = 0;
+			};
+
+			ThreadCache()
+				:RemoteFree(nullptr), Allocs(0), Mallocs(0)
+			{
+				Free.fill(nullptr);
+				Count.fill(0);
+			}
+
+			void Push(uint32_t cls, FreeNode* node)
+			{
+				if (Count[cls] >= ClassLimit(cls))
+				{
+					std::free(static_cast<Header*>(static_cast<void*>(node)) - 1);
+					return;
+				}
+				node->Next = Free[cls];
+				Free[cls] = node;
+				Count[cls]++;
+			}
+
+			void PushRemote(ThreadCache* owner, FreeNode* node)
+			{
+				auto& b = Batches[(reinterpret_cast<uintptr_t>(owner) >> 6) % Batches.size()];
+				if (b.Owner != owner)
+				{
+					Flush(b);
+					b.Owner = owner;
+				}
+
+				node->Next = b.Head;
+				b.Head = node;
+				if (nullptr == b.Tail)
+				{
+					b.Tail = node;
+				}
+
+				if (++b.Count == REMOTE_BATCH_SIZE)
+				{
+					Flush(b);
+				}
+			}
+
+			void Flush(Batch& b)
+			{
+				if (0 != b.Count)
+				{
+					PushChain(b.Owner, b.Head, b.Tail);
+				}
+				b = Batch();
+			}
+
+			void FlushAll()
+			{
+				for (auto& b : Batches)
+				{
+					Flush(b);
+				}
+			}
+
+			//取回其它线程交还的内存
+			void DrainRemote()
+			{
+				auto node = RemoteFree.exchange(nullptr, std::memory_order_acquire);
+				while (nullptr != node)
+				{
+					auto next = node->Next;
+					Push((static_cast<Header*>(static_cast<void*>(node)) - 1)->Class, node);
+					node = next;
+				}
+			}
+
+			std::array<FreeNode*, CLASS_NUM>		Free;
+			std::array<uint32_t, CLASS_NUM>			Count;
+			std::array<Batch, 4>							Batches;
+			std::atomic<FreeNode*>						RemoteFree;
+			std::atomic<uint64_t>							Allocs;
+			std::atomic<uint64_t>							Mallocs;
+		};
+
+		//线程退出后 ThreadCache 不会释放，新的线程会继续使用，其它线程持有的内存仍然可以交还
+		struct Registry
+		{
+			ThreadCache* Acquire()
+			{
+				std::lock_guard<std::mutex> lck(Lock);
+				if (!Idle.empty())
+				{
+					auto c = Idle.back();
+					Idle.pop_back();
+					return c;
+				}
+				auto c = new ThreadCache();
+				All.push_back(c);
+				return c;
+			}
+
+			void Release(ThreadCache* c)
+			{
+				std::lock_guard<std::mutex> lck(Lock);
+				Idle.push_back(c);
+			}
+
+			std::mutex								Lock;
+			std::vector<ThreadCache*>		All;
+			std::vector<ThreadCache*>		Idle;
+		};
+
+		struct LocalCache
+		{
+			LocalCache(bool* exited)
+				:Cache(GetRegistry().Acquire()), Exited(exited)
+			{
+			}
+
+			~LocalCache()
+			{
+				*Exited = true;
+				Cache->FlushAll();
+				GetRegistry().Release(Cache);
+			}
+
+			ThreadCache*		Cache;
+			bool*					Exited;
+		};
+
+		static Registry& GetRegistry()
+		{
+			//不析构, 进程退出时其它线程可能还在释放内存
+			static Registry* reg = new Registry();
+			return *reg;
+		}
+
+		static ThreadCache* Local()
+		{
+			thread_local bool exited = false;
+			if (exited)
+				return nullptr;
+			thread_local LocalCache local(&exited);
+			return local.Cache;
+		}
+
+		static void PushChain(ThreadCache* owner, FreeNode* head, FreeNode* tail)
+		{
+			auto old = owner->RemoteFree.load(std::memory_order_relaxed);
+			do
+			{
+				tail->Next = old;
+			} while (!owner->RemoteFree.compare_exchange_weak(old, head, std::memory_order_release, std::memory_order_relaxed));
+		}
+
+		static void* NewBlock(ThreadCache* owner, uint32_t cls, size_t size)
+		{
+			auto header = static_cast<Header*>(std::malloc(sizeof(Header) + size));
+			if (nullptr == header)
+			{
+				throw std::bad_alloc();
+			}
+			header->Owner = owner;
+			header->Class = cls;
+			return header + 1;
+		}
+
+		static uint32_t HighBit(size_t v)
+		{
+			uint32_t n = 0;
+			while (v >>= 1)
+			{
+				n++;
+			}
+			return n;
+		}
+
+		static uint32_t SizeClass(size_t size)
+		{
+			if (size <= 32)
+				return 0;
+			//(2^b, 1.5*2^b] 和 (1.5*2^b, 2^(b+1)] 各为一级
+			auto n = size - 1;
+			auto b = HighBit(n);
+			return 1 + (b - 5) * 2 + static_cast<uint32_t>((n >> (b - 1)) & 1);
+		}
+
+		static size_t ClassSize(uint32_t cls)
+		{
+			if (0 == cls)
+				return 32;
+			size_t b = 5 + (cls - 1) / 2;
+			return ((cls - 1) % 2) ? (size_t(1) << (b + 1)) : (size_t(3) << (b - 1));
+		}
+
+		static uint32_t ClassLimit(uint32_t cls)
+		{
+			auto n = MAX_CACHED_BYTES / ClassSize(cls);
+			return static_cast<uint32_t>(n < 4 ? 4 : n);
+		}
+	};
+
+	//使用 MemoryPool 的 allocator, 可用于 std::allocate_shared 和标准容器
+	template<typename T>
+	class PoolAllocator
+	{
+	public:
+		using value_type = T;
+
+		PoolAllocator() noexcept
+		{
+		}
+
+		template<typename U>
+		PoolAllocator(const PoolAllocator<U>&) noexcept
+		{
+		}
+
+		T* allocate(size_t n)
+		{
+			return static_cast<T*>(MemoryPool::Allocate(n * sizeof(T)));
+		}
+
+		void deallocate(T* p, size_t)
+		{
+			MemoryPool::Deallocate(p);
+		}
+
+		template<typename U>
+		bool operator==(const PoolAllocator<U>&) const noexcept
+		{
+			return true;
+		}
+
+		template<typename U>
+		bool operator!=(const PoolAllocator<U>&) const noexcept
+		{
+			return false;
+		}
+	};
+};
@@ -14,6 +14,7 @@ Licensed under the MIT License <http://opensource.org/licenses/MIT>.
 #include <memory>
 #include <type_traits>
 #include <string>
+#include "MemoryPool.hpp"
 
 namespace moon
 {
@@ -24,6 +25,8 @@ namespace moon
 	{
 	public:
 		using StreamType = MemoryStream;
+		///buffer is allocated from MemoryPool
+		using BufferType = std::vector<uint8_t, PoolAllocator<uint8_t>>;
 		///buffer default size
 		constexpr static size_t    DEFAULT_CAPACITY = 64;
 
@@ -163,7 +166,7 @@ namespace moon
 		}
 
 	protected:
-		std::vector<uint8_t>::iterator Writeable()
+		BufferType::iterator Writeable()
 		{
 			return begin() + m_writepos;
 		}
@@ -206,13 +209,13 @@ namespace moon
 			}
 		}
 
-		std::vector<uint8_t>::iterator begin()
+		BufferType::iterator begin()
 		{
 			return m_data.begin();
 		}
 
 	protected:
-		std::vector<uint8_t>		m_data;
+		BufferType						m_data;
 		//read position
 		size_t								m_readpos;
 		//write position
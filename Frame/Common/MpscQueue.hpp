@@ -0,0 +1,112 @@
+/****************************************************************************
+
+Git <https://github.com/sniper00/MoonNetLua>
+E-Mail <hanyongtao@live.com>
+Copyright (c) 2015-2016 moon
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+
+****************************************************************************/
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include "MemoryPool.hpp"
+
+namespace moon
+{
+	//无锁的多生产者单消费者队列
+	//PushBack 是线程安全的，PopFront 和 Empty 只能在同一个消费者线程中调用
+	template<class T>
+	class MpscQueue
+	{
+		struct Node
+		{
+			Node()
+				:next(nullptr)
+			{
+			}
+
+			explicit Node(const T& v)
+				:value(v), next(nullptr)
+			{
+			}
+
+			T										value;
+			std::atomic<Node*>				next;
+		};
+	public:
+		MpscQueue()
+			:m_head(NewNode()), m_size(0)
+		{
+			m_tail = m_head.load();
+		}
+
+		~MpscQueue()
+		{
+			while (nullptr != m_tail)
+			{
+				auto next = m_tail->next.load();
+				DeleteNode(m_tail);
+				m_tail = next;
+			}
+		}
+
+		MpscQueue(const MpscQueue& t) = delete;
+		MpscQueue& operator=(const MpscQueue& t) = delete;
+
+		void PushBack(const T& x)
+		{
+			auto node = NewNode(x);
+			m_size++;
+			auto prev = m_head.exchange(node);
+			prev->next.store(node);
+		}
+
+		bool PopFront(T& x)
+		{
+			auto next = m_tail->next.load();
+			if (nullptr == next)
+			{
+				return false;
+			}
+			x = std::move(next->value);
+			next->value = T();
+			DeleteNode(m_tail);
+			m_tail = next;
+			m_size--;
+			return true;
+		}
+
+		bool Empty()
+		{
+			return nullptr == m_tail->next.load();
+		}
+
+		//近似值
+		size_t Size()
+		{
+			return m_size.load();
+		}
+
+	private:
+		//节点从 MemoryPool 分配, 由消费者线程释放时批量交还给生产者线程
+		template<typename... Args>
+		static Node* NewNode(Args&&... args)
+		{
+			return new (MemoryPool::Allocate(sizeof(Node))) Node(std::forward<Args>(args)...);
+		}
+
+		static void DeleteNode(Node* node)
+		{
+			node->~Node();
+			MemoryPool::Deallocate(node);
+		}
+
+		//生产者插入的位置
+		std::atomic<Node*>					m_head;
+		//消费者读取的位置，总是指向一个已经读取过的节点
+		Node*										m_tail;
+		std::atomic<size_t>					m_size;
+	};
+}
@@ -112,11 +112,11 @@ namespace moon
 			return m_removed;
 		}
 	private:
-		timer_handler				m_handler;//ص
+		timer_handler				m_handler;//调度器回掉
 		uint64_t						m_id;
 		int64_t							m_endtime;
 		int64_t							m_duration;
-		int32_t							m_repeatTimes;//ظ-1ѭ
+		int32_t							m_repeatTimes;//重复次数，-1循环
 		bool								m_removed;
 	};
 }
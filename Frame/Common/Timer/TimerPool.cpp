@@ -14,7 +14,7 @@ Licensed under the MIT License <http://opensource.org/licenses/MIT>.
 using namespace moon;
 
 TimerPool::TimerPool()
-:m_tick(0),m_inc(1), m_Stop(false)
+:m_tick(0),m_prevTick(millseconds()),m_inc(1), m_Stop(false)
 {
 	m_wheels.emplace_back(TimerWheel<std::vector<uint64_t>, wheel_size>());
 	m_wheels.emplace_back(TimerWheel<std::vector<uint64_t>, wheel_size>());
@@ -79,10 +79,9 @@ void TimerPool::Update()
 	}
 	m_new.clear();
 
-	static auto prewTick = millseconds();
 	auto nowTick = millseconds();
-	m_tick += (nowTick - prewTick);
-	prewTick = nowTick;
+	m_tick += (nowTick - m_prevTick);
+	m_prevTick = nowTick;
 
 	while(m_tick >= PRECISION)
 	{
@@ -180,7 +179,7 @@ void TimerPool::addTimer(const timer_context_ptr& t)
 		diff = (diff >= 0) ? diff : 0;
 
 		auto offset = diff%PRECISION;
-		//У
+		//校正
 		if (offset > 0)
 		{
 			diff += PRECISION;
@@ -20,43 +20,43 @@ namespace moon
 	class TimerPool
 	{	
 	public:
-		//ÿʱӴС255
+		//每个时间轮子大小，最大255
 		static const  uint8_t  wheel_size = 255;
-		// ms
+		//精度 ms
 		static const int32_t PRECISION = 15;
 
 		TimerPool();
 
 		~TimerPool();
 		/**
-		* һִֻһεļʱ
+		* 添加一个只执行一次的计时器
 		*
-		* @duration ʱ ms
-		* @callBack  ص
+		* @duration 计时器间隔 ms
+		* @callBack  回掉函数
 		*  typedef   std::function<void()> timer_handler;
-		* ؼʱID
+		* 返回计时器ID
 		*/
 		uint64_t  ExpiredOnce(int64_t duration,const timer_handler& callBack);
 
 		/**
-		* ظִеļʱ
+		* 添加重复执行的计时器
 		*
-		* @duration ʱ ms
-		* @times ظ(-1 ѭ)
-		* @callBack ص
+		* @duration 计时器间隔 ms
+		* @times 重复次数，(-1 无限循环)
+		* @callBack 回掉函数
 		*  typedef   std::function<void()> timer_handler;
-		* ؼʱID
+		* 返回计时器ID
 		*/
 		uint64_t  Repeat(int64_t duration, int32_t times, const timer_handler& callBack);
 
 		/**
-		* Ƴһʱ
+		* 移除一个计时器
 		*
-		* @timerid ʱ ID
+		* @timerid 计时器 ID
 		*/
 		void Remove(uint64_t timerid);
 		
-		//߼߳Ҫʱ
+		//逻辑线程需要调用这个函数，驱动计时器
 		void Update();
 
 		void StopAllTimer();
@@ -75,6 +75,8 @@ namespace moon
 		std::unordered_map<uint64_t, timer_context_ptr>			m_timers;
 		std::vector<timer_context_ptr>										m_new;
 		int64_t																				m_tick;
+		//上一次 Update 的时间, 每个 TimerPool 单独记录
+		int64_t																				m_prevTick;
 		uint64_t																			m_inc;
 		bool																					m_Stop;
 	};
@@ -50,7 +50,7 @@ namespace moon
 		}
 	}
 
-	//std::bind ʹãʱ󶨳ԱʱʱҪ
+	//std::bind 特殊使用，有时绑定成员函数的时候暂时不需要传入对象
 	//std::function<R(TClass*,Args...)> make_bind(&some_member_func)
 	template<typename R, typename TClass, typename... Args, typename Indices = make_index_sequence<sizeof...(Args)+1>>
 	auto make_bind(R(TClass::*fn)(Args...))->decltype(detail::make_bind_imp(fn, Indices()))
@@ -0,0 +1,323 @@
+/****************************************************************************
+
+Git <https://github.com/sniper00/MoonNetLua>
+E-Mail <hanyongtao@live.com>
+Copyright (c) 2015-2016 moon
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+
+****************************************************************************/
+
+#include "Cluster.h"
+#include "Message.h"
+#include "ModuleManager.h"
+#include "ObjectCreateHelper.h"
+#include "Detail/Log/Log.h"
+#include "Detail/Network/NetworkFrame.h"
+#include "Common/BinaryWriter.hpp"
+#include "Common/BinaryReader.hpp"
+#include "Common/TupleUtils.hpp"
+
+namespace moon
+{
+	//消息头: type(1) sender(4) receiver(4) rpcID(8) userdata长度(2) data长度(4)
+	constexpr size_t CLUSTER_MESSAGE_HEAD_SIZE = 23;
+	//type 的最高位表示高优先级
+	constexpr uint8_t CLUSTER_HIGH_PRIORITY = 0x80;
+	//发送批次的初始容量
+	constexpr size_t CLUSTER_BATCH_CAPACITY = 8192;
+	//握手: magic(4) machineID(1), 连接建立后发送的第一个数据包
+	constexpr uint32_t CLUSTER_HANDSHAKE_MAGIC = 0x4D4E434C;
+	constexpr size_t CLUSTER_HANDSHAKE_SIZE = 5;
+
+	struct Cluster::Peer
+	{
+		Peer(uint8_t machineID, const std::string& ip, const std::string& port)
+			:MachineID(machineID)
+			,IP(ip)
+			,Port(port)
+			,Session(0)
+			,FlushPosted(false)
+			,Pending(ObjectCreateHelper<MemoryStream>::Create(CLUSTER_BATCH_CAPACITY))
+		{
+		}
+
+		uint8_t																		MachineID;
+		std::string																	IP;
+		std::string																	Port;
+		std::mutex																	Lock;
+		//连接到该 machine 的 SessionID, 0 表示未连接
+		SessionID																	Session;
+		//是否已经向网络线程投递了 Flush
+		bool																			FlushPosted;
+		//等待发送的消息批次
+		MemoryStreamPtr														Pending;
+	};
+
+	static void WriteMessage(MemoryStream& ms, const MessagePtr& msg)
+	{
+		BinaryWriter<MemoryStream> bw(&ms);
+		uint8_t type = (uint8_t)msg->GetType();
+		if (msg->GetPriority() == EMessagePriority::High)
+		{
+			type |= CLUSTER_HIGH_PRIORITY;
+		}
+		bw << type;
+		bw << msg->GetSender();
+		bw << msg->GetReceiver();
+		bw << msg->GetRPCID();
+		bw << (uint16_t)msg->UserDataSize();
+		bw.WriteArray(msg->UserData(), msg->UserDataSize());
+		bw << (uint32_t)msg->Size();
+		bw.WriteArray(msg->Data(), msg->Size());
+	}
+
+	Cluster::Cluster(ModuleManager* mgr)
+		:m_Manager(mgr)
+		,m_Running(false)
+		,m_SendCount(0)
+		,m_RecvCount(0)
+	{
+		m_Net = std::make_shared<NetWorkFrame>(make_bind(&Cluster::OnNetMessage, this), 1);
+	}
+
+	Cluster::~Cluster()
+	{
+	}
+
+	void Cluster::Listen(const std::string & ip, const std::string & port)
+	{
+		m_Net->Listen(ip, port);
+	}
+
+	void Cluster::AddPeer(uint8_t machineID, const std::string & ip, const std::string & port)
+	{
+		Assert(machineID != m_Manager->GetMachineID(), "Cluster::AddPeer: can not add self as peer");
+		//m_Peers 在 Run 之后只读, 不加锁
+		Assert(!m_Running, "Cluster::AddPeer: must be called before Run");
+		m_Peers[machineID] = std::make_shared<Peer>(machineID, ip, port);
+	}
+
+	void Cluster::Send(const MessagePtr & msg)
+	{
+		uint8_t machineID = (msg->GetReceiver() >> 24) & 0xFF;
+		auto& peer = m_Peers[machineID];
+		if (nullptr == peer)
+		{
+			CONSOLE_WARN("Cluster: machine [%u] is not a peer, message dropped.", machineID);
+			return;
+		}
+
+		size_t len = CLUSTER_MESSAGE_HEAD_SIZE + msg->UserDataSize() + msg->Size();
+		if (len > MAX_MSG_SIZE)
+		{
+			CONSOLE_WARN("Cluster: message size %u exceeds the max limit %u, message dropped.", (uint32_t)len, (uint32_t)MAX_MSG_SIZE);
+			return;
+		}
+
+		gurad_lock lck(peer->Lock);
+
+		//当前批次已满
+		if (peer->Pending->Size() + len > MAX_MSG_SIZE)
+		{
+			if (0 == peer->Session)
+			{
+				CONSOLE_WARN("Cluster: machine [%u] is not connected and send buffer is full, message dropped.", machineID);
+				return;
+			}
+			m_Net->Send(peer->Session, peer->Pending);
+			peer->Pending = ObjectCreateHelper<MemoryStream>::Create(CLUSTER_BATCH_CAPACITY);
+		}
+
+		WriteMessage(*peer->Pending, msg);
+		m_SendCount++;
+
+		//同一轮网络循环中发送的消息合并为一个批次
+		if (!peer->FlushPosted && 0 != peer->Session)
+		{
+			peer->FlushPosted = true;
+			m_Net->Post(peer->Session, [this, peer]() { Flush(peer); });
+		}
+	}
+
+	void Cluster::Run()
+	{
+		Interval(1000);
+		onUpdate = std::bind(&Cluster::Update, this, std::placeholders::_1);
+		m_Running = true;
+		m_Net->Run();
+		LoopThread::Run();
+
+		CONSOLE_TRACE("Cluster [%u] Run", m_Manager->GetMachineID());
+	}
+
+	void Cluster::Stop()
+	{
+		LoopThread::Stop();
+		m_Net->Stop();
+
+		CONSOLE_TRACE("Cluster [%u] Stop", m_Manager->GetMachineID());
+	}
+
+	uint64_t Cluster::GetSendCount()
+	{
+		return m_SendCount.load();
+	}
+
+	uint64_t Cluster::GetRecvCount()
+	{
+		return m_RecvCount.load();
+	}
+
+	//断线重连
+	void Cluster::Update(uint32_t)
+	{
+		for (auto& peer : m_Peers)
+		{
+			if (nullptr == peer)
+				continue;
+
+			{
+				gurad_lock lck(peer->Lock);
+				if (0 != peer->Session)
+					continue;
+			}
+
+			SessionID session = m_Net->SyncConnect(peer->IP, peer->Port);
+			if (0 == session)
+				continue;
+
+			CONSOLE_TRACE("Cluster: connected to machine [%u] %s:%s", peer->MachineID, peer->IP.c_str(), peer->Port.c_str());
+
+			//握手在所有消息批次之前发送
+			auto handshake = ObjectCreateHelper<MemoryStream>::Create(CLUSTER_HANDSHAKE_SIZE);
+			BinaryWriter<MemoryStream> bw(handshake.get());
+			bw << CLUSTER_HANDSHAKE_MAGIC;
+			bw << m_Manager->GetMachineID();
+			m_Net->Send(session, handshake);
+
+			gurad_lock lck(peer->Lock);
+			peer->Session = session;
+			if (peer->Pending->Size() != 0 && !peer->FlushPosted)
+			{
+				peer->FlushPosted = true;
+				m_Net->Post(peer->Session, [this, peer]() { Flush(peer); });
+			}
+		}
+	}
+
+	void Cluster::Flush(const PeerPtr& peer)
+	{
+		gurad_lock lck(peer->Lock);
+		peer->FlushPosted = false;
+		if (0 == peer->Session || 0 == peer->Pending->Size())
+			return;
+		m_Net->Send(peer->Session, peer->Pending);
+		peer->Pending = ObjectCreateHelper<MemoryStream>::Create(CLUSTER_BATCH_CAPACITY);
+	}
+
+	void Cluster::Handshake(SessionID sessionID, const MemoryStreamPtr & data)
+	{
+		uint8_t machineID = 0;
+		bool ok = false;
+		if (data->Size() == CLUSTER_HANDSHAKE_SIZE)
+		{
+			BinaryReader br(data->Data(), data->Size());
+			auto magic = br.Read<uint32_t>();
+			machineID = br.Read<uint8_t>();
+			ok = (magic == CLUSTER_HANDSHAKE_MAGIC && machineID != m_Manager->GetMachineID() && nullptr != m_Peers[machineID]);
+		}
+
+		if (!ok)
+		{
+			CONSOLE_WARN("Cluster: session [%u] handshake failed, machine [%u] is not a peer", sessionID, machineID);
+			m_Net->CloseSession(sessionID, ESocketState::ForceClose);
+			return;
+		}
+
+		m_Verified.emplace(sessionID, machineID);
+		CONSOLE_TRACE("Cluster: machine [%u] session [%u] verified", machineID, sessionID);
+	}
+
+	void Cluster::OnNetMessage(ESocketMessageType type, SessionID sessionID, const MemoryStreamPtr & data)
+	{
+		switch (type)
+		{
+		case ESocketMessageType::RecvData:
+		{
+			auto verified = m_Verified.find(sessionID);
+			if (verified == m_Verified.end())
+			{
+				Handshake(sessionID, data);
+				break;
+			}
+
+			try
+			{
+				BinaryReader br(data->Data(), data->Size());
+				while (br.Size() != 0)
+				{
+					auto msgType = br.Read<uint8_t>();
+					auto sender = br.Read<ModuleID>();
+					auto receiver = br.Read<ModuleID>();
+					auto rpcID = br.Read<uint64_t>();
+					auto userdataLen = br.Read<uint16_t>();
+					Assert(userdataLen <= br.Size(), "illegal userdata length");
+					std::string userdata((const char*)br.Data(), userdataLen);
+					br.Skip(userdataLen);
+					auto len = br.Read<uint32_t>();
+					Assert(len <= br.Size(), "illegal data length");
+					//只接受握手时声明的 machine 上的 Module 发出的消息
+					Assert(((sender >> 24) & 0xFF) == verified->second, "sender does not belong to the peer machine");
+
+					if (((receiver >> 24) & 0xFF) != m_Manager->GetMachineID())
+					{
+						CONSOLE_WARN("Cluster: receive message for machine [%u], message dropped.", (receiver >> 24) & 0xFF);
+						br.Skip(len);
+						continue;
+					}
+
+					auto msg = ObjectCreateHelper<Message>::Create(len);
+					msg->SetType(EMessageType(msgType & ~CLUSTER_HIGH_PRIORITY));
+					if (msgType & CLUSTER_HIGH_PRIORITY)
+					{
+						msg->SetPriority(EMessagePriority::High);
+					}
+					msg->SetSender(sender);
+					msg->SetReceiver(receiver);
+					msg->SetRPCID(rpcID);
+					msg->SetUserData(userdata);
+					msg->WriteData(br.Data(), len);
+					br.Skip(len);
+
+					m_RecvCount++;
+					m_Manager->DispatchMessage(msg);
+				}
+			}
+			catch (std::exception& e)
+			{
+				CONSOLE_ERROR("Cluster: illegal data from session [%u]: %s", sessionID, e.what());
+				m_Net->CloseSession(sessionID, ESocketState::IllegalDataLength);
+			}
+			break;
+		}
+		case ESocketMessageType::Close:
+		{
+			m_Verified.erase(sessionID);
+			for (auto& peer : m_Peers)
+			{
+				if (nullptr == peer)
+					continue;
+				gurad_lock lck(peer->Lock);
+				if (peer->Session == sessionID)
+				{
+					peer->Session = 0;
+					CONSOLE_WARN("Cluster: machine [%u] disconnected", peer->MachineID);
+				}
+			}
+			break;
+		}
+		default:
+			break;
+		}
+	}
+};
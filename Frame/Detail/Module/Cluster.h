@@ -0,0 +1,93 @@
+/****************************************************************************
+
+Git <https://github.com/sniper00/MoonNetLua>
+E-Mail <hanyongtao@live.com>
+Copyright (c) 2015-2016 moon
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+
+****************************************************************************/
+
+#pragma once
+#include "MacroDefine.h"
+#include "Common/LoopThread.hpp"
+#include "Common/noncopyable.hpp"
+#include "Detail/Network/NetworkDefine.h"
+
+namespace moon
+{
+	class ModuleManager;
+	class NetWorkFrame;
+
+	DECLARE_SHARED_PTR(Message)
+
+	//跨进程 Module 通讯。 每个 machine 之间维持一条持久的TCP连接，
+	//所有 Module 的消息复用这条连接，并在网络线程中批量发送。
+	//连接建立后先发送握手(本机 machine_id), 接收方只接受 AddPeer 配置过的 machine,
+	//并且只接受该 machine 上的 Module 发出的消息。 握手没有加密和认证, 只用于防止误连,
+	//Listen 应该绑定在只有集群内机器可以访问的网络接口上
+	class Cluster :public LoopThread, noncopyable
+	{
+	public:
+		Cluster(ModuleManager* mgr);
+
+		~Cluster();
+
+		/**
+		* 监听其它 machine 的连接
+		*
+		* @ip
+		* @port
+		*/
+		void			Listen(const std::string& ip, const std::string& port);
+
+		/**
+		* 添加一个远程 machine, Run 之后会自动连接（断线重连）。 只能在 Run 之前调用
+		*
+		* @machineID 远程 machine 的 machine_id
+		* @ip
+		* @port
+		*/
+		void			AddPeer(uint8_t machineID, const std::string& ip, const std::string& port);
+
+		/**
+		* 发送消息到接收者所在的 machine, 这个函数是线程安全的
+		*
+		* @msg
+		*/
+		void			Send(const MessagePtr& msg);
+
+		void			Run();
+
+		void			Stop();
+
+		/**
+		* 获取发送，接收的消息数量
+		*/
+		uint64_t		GetSendCount();
+
+		uint64_t		GetRecvCount();
+	private:
+		struct Peer;
+		using PeerPtr = std::shared_ptr<Peer>;
+
+		void			Update(uint32_t interval);
+
+		void			Flush(const PeerPtr& peer);
+
+		/**
+		* 校验连接发送的第一个数据包, 不是配置过的 machine 则关闭连接
+		*/
+		void			Handshake(SessionID sessionID, const MemoryStreamPtr& data);
+
+		void			OnNetMessage(ESocketMessageType type, SessionID sessionID, const MemoryStreamPtr& data);
+	private:
+		ModuleManager*																m_Manager;
+		std::shared_ptr<NetWorkFrame>										m_Net;
+		std::array<PeerPtr, 256>													m_Peers;
+		std::atomic_bool																m_Running;
+		//已经握手的连接和对方的 machineID, 只在网络线程中访问
+		std::unordered_map<SessionID, uint8_t>								m_Verified;
+		std::atomic<uint64_t>														m_SendCount;
+		std::atomic<uint64_t>														m_RecvCount;
+	};
+};
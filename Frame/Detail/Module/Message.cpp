@@ -11,14 +11,20 @@ Licensed under the MIT License <http://opensource.org/licenses/MIT>.
 #include "ModuleManager.h"
 #include "ObjectCreateHelper.h"
 #include "Detail/Log/Log.h"
+#include <cstring>
 
 
 namespace moon
 {
+	constexpr uint8_t MESSAGE_FLAG_HIGH_PRIORITY = 1;
+
 	Message::Message(size_t capacity, size_t headreserved)
 	{
 		Init();
-		m_Data = ObjectCreateHelper<MemoryStream>::Create(capacity, headreserved);
+		if (capacity + headreserved > INLINE_SIZE)
+		{
+			m_Data = ObjectCreateHelper<MemoryStream>::Create(capacity, headreserved);
+		}
 		//CONSOLE_TRACE("message new %x",(size_t)(this));
 	}
 
@@ -32,6 +38,10 @@ namespace moon
 
 	Message::~Message()
 	{
+		if (nullptr != m_ExtUserData)
+		{
+			MemoryPool::Deallocate(m_ExtUserData);
+		}
 		//CONSOLE_TRACE("message release %x", (size_t)(this));
 	}
 
@@ -57,12 +67,66 @@ namespace moon
 
 	void Message::SetUserData(const std::string & userdata)
 	{
-		m_UserData = std::move(userdata);
+		Assert(userdata.size() <= UINT16_MAX, "userdata is too long!");
+
+		if (nullptr != m_ExtUserData)
+		{
+			MemoryPool::Deallocate(m_ExtUserData);
+			m_ExtUserData = nullptr;
+		}
+
+		m_UserDataSize = (uint16_t)userdata.size();
+		if (m_UserDataSize <= INLINE_SIZE - m_InlineSize)
+		{
+			memcpy(m_Inline + INLINE_SIZE - m_UserDataSize, userdata.data(), m_UserDataSize);
+		}
+		else
+		{
+			m_ExtUserData = (uint8_t*)MemoryPool::Allocate(m_UserDataSize);
+			memcpy(m_ExtUserData, userdata.data(), m_UserDataSize);
+		}
+	}
+
+	std::string Message::GetUserData() const
+	{
+		return std::string((const char*)UserData(), UserDataSize());
+	}
+
+	const uint8_t * Message::UserData() const
+	{
+		return (nullptr != m_ExtUserData) ? m_ExtUserData : (m_Inline + INLINE_SIZE - m_UserDataSize);
+	}
+
+	size_t Message::UserDataSize() const
+	{
+		return m_UserDataSize;
+	}
+
+	void Message::WriteData(const uint8_t * data, size_t len)
+	{
+		if (0 == len)
+			return;
+
+		if (nullptr == m_Data)
+		{
+			size_t userdata = (nullptr == m_ExtUserData) ? m_UserDataSize : 0;
+			if (m_InlineSize + len + userdata <= INLINE_SIZE)
+			{
+				memcpy(m_Inline + m_InlineSize, data, len);
+				m_InlineSize += (uint32_t)len;
+				return;
+			}
+			Spill(m_InlineSize + len);
+		}
+		m_Data->WriteBack(data, 0, len);
 	}
 
-	const std::string & Message::GetUserData() const
+	void Message::Spill(size_t capacity)
 	{
-		return m_UserData;
+		auto ms = ObjectCreateHelper<MemoryStream>::Create(capacity);
+		ms->WriteBack(m_Inline, 0, m_InlineSize);
+		m_Data = ms;
+		m_InlineSize = 0;
 	}
 
 	void Message::SetRPCID(uint64_t rpcID)
@@ -75,6 +139,16 @@ namespace moon
 		return m_RPCID;
 	}
 
+	void Message::SetTraceID(uint64_t traceID)
+	{
+		m_TraceID = traceID;
+	}
+
+	uint64_t Message::GetTraceID() const
+	{
+		return m_TraceID;
+	}
+
 	void Message::SetType(EMessageType type)
 	{
 		m_Type =(uint8_t)type;
@@ -85,15 +159,39 @@ namespace moon
 		return (EMessageType)m_Type;
 	}
 
+	void Message::SetPriority(EMessagePriority priority)
+	{
+		if (priority == EMessagePriority::High)
+		{
+			m_Flag |= MESSAGE_FLAG_HIGH_PRIORITY;
+		}
+		else
+		{
+			m_Flag &= ~MESSAGE_FLAG_HIGH_PRIORITY;
+		}
+	}
+
+	EMessagePriority Message::GetPriority() const
+	{
+		if ((m_Flag & MESSAGE_FLAG_HIGH_PRIORITY) || m_Type == (uint8_t)EMessageType::ModuleRPC || m_Type == (uint8_t)EMessageType::ModuleRPCTimeout
+			|| m_Type == (uint8_t)EMessageType::ModuleNameChanged)
+		{
+			return EMessagePriority::High;
+		}
+		return EMessagePriority::Normal;
+	}
+
 	void Message::Init()
 	{
 		m_Type = (uint8_t)EMessageType::Unknown;
 		m_Flag = 0;
+		m_UserDataSize = 0;
+		m_InlineSize = 0;
 		m_Sender = 0;
 		m_Receiver = 0;
-		m_UserID = 0;
-		m_SubUserID = 0;
 		m_RPCID = 0;
+		m_TraceID = 0;
+		m_ExtUserData = nullptr;
 	}
 }
 
@@ -10,30 +10,179 @@ Licensed under the MIT License <http://opensource.org/licenses/MIT>.
 #include "Module.h"
 #include "Message.h"
 #include "ModuleManager.h"
+#include "Worker.h"
 #include "ObjectCreateHelper.h"
+#include "Common/MpscQueue.hpp"
+#include "Common/Time.hpp"
+#include "Common/Histogram.hpp"
+#include "Tracer.h"
+#include <queue>
 
 namespace moon
 {
+	//max high priority messages handled in a row while normal messages are waiting
+	constexpr uint32_t HIGH_PRIORITY_BURST = 8;
+
+	static int64_t MicroSecond()
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	static int64_t NanoSecond()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	//runtime statistics, only written by the Worker thread running the module
+	struct ModuleStats
+	{
+		ModuleStats()
+			:MessagesIn(0)
+			,BytesIn(0)
+			,MessagesOut(0)
+			,BytesOut(0)
+			,QueueMax(0)
+		{
+		}
+
+		static void Add(std::atomic<uint64_t>& v, uint64_t n)
+		{
+			v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+		}
+
+		std::atomic<uint64_t>			MessagesIn;
+		std::atomic<uint64_t>			BytesIn;
+		std::atomic<uint64_t>			MessagesOut;
+		std::atomic<uint64_t>			BytesOut;
+		//mailbox size seen when the module is scheduled
+		std::atomic<uint64_t>			QueueMax;
+		//ns, one sample per OnMessageEx or OnMessageBatch call
+		Histogram								HandleTime;
+		//ns per Update call
+		Histogram								UpdateTime;
+	};
+
 	struct Module::ModuleImp
 	{
+		struct PendingRPC
+		{
+			ModuleID		Receiver;
+			//MicroSecond() when sent
+			int64_t		Start;
+		};
+
 		ModuleImp()
 			:ID(0)
 			,IncreCacheID(1)
 			,EnableUpdate(false)
+			,UpdateInterval(0)
+			,MessageBatch(0)
 			,Manager(nullptr)
+			,Owner(nullptr)
 			,Ok(true)
+			,Scheduled(false)
+			,Pinned(false)
+			,HighBurst(0)
+			,RPCIncreID(0)
+			,RPCWakeup(0)
+			,RPCSent(0)
+			,RPCReplied(0)
+			,RPCTimeout(0)
+			,RPCCancelled(0)
+			,RPCLate(0)
+			,RPCLatencySum(0)
+			,RPCLatencyMax(0)
+			,Stats(nullptr)
 		{
 		}
 
+		~ModuleImp()
+		{
+			delete Stats.load();
+		}
+
+		//created on first use after ModuleManager::SetModuleStats(true), nullptr while disabled
+		ModuleStats* GetStats()
+		{
+			if (!Manager->IsModuleStatsEnabled())
+				return nullptr;
+			auto s = Stats.load(std::memory_order_relaxed);
+			if (nullptr == s)
+			{
+				s = new ModuleStats();
+				Stats.store(s, std::memory_order_release);
+			}
+			return s;
+		}
+
+		void CountSend(size_t bytes)
+		{
+			auto s = GetStats();
+			if (nullptr != s)
+			{
+				ModuleStats::Add(s->MessagesOut, 1);
+				ModuleStats::Add(s->BytesOut, bytes);
+			}
+		}
+
+		//take the next Message, see HIGH_PRIORITY_BURST
+		bool PopMessage(MessagePtr& msg)
+		{
+			if (HighBurst < HIGH_PRIORITY_BURST || MessageQueue.Empty())
+			{
+				if (HighQueue.PopFront(msg))
+				{
+					HighBurst++;
+					return true;
+				}
+			}
+			HighBurst = 0;
+			return MessageQueue.PopFront(msg) || HighQueue.PopFront(msg);
+		}
+
+		bool Empty()
+		{
+			return HighQueue.Empty() && MessageQueue.Empty();
+		}
+
 		ModuleID																ID;
 		uint32_t																IncreCacheID;
 		std::string																Name;
 		std::string																Config;
 		bool																		EnableUpdate;
+		uint32_t																UpdateInterval;
+		uint32_t																MessageBatch;
+		//messages taken in the current turn, reused to avoid allocations
+		std::vector<MessagePtr>											Batch;
 		bool																		Ok;
 		ModuleManager*													Manager;
-		std::deque<MessagePtr>									MessageQueue;
+		std::atomic<Worker*>													Owner;
+		MpscQueue<MessagePtr>									MessageQueue;
+		MpscQueue<MessagePtr>									HighQueue;
+		//is in the Worker's ready queue or being handled
+		std::atomic_bool														Scheduled;
+		//never migrates, see SetPinned
+		std::atomic_bool														Pinned;
 		std::unordered_map<uint32_t, MemoryStreamPtr> CacheDatas;
+		//high priority messages handled in a row, only used in the Worker thread
+		uint32_t																HighBurst;
+
+		//requests sent by SendRPC, only used in the Worker thread
+		uint64_t																RPCIncreID;
+		std::unordered_map<uint64_t, PendingRPC>					PendingRPCs;
+		//(deadline, rpcID), entries of completed requests are skipped when they reach the top
+		std::priority_queue<std::pair<int64_t, uint64_t>, std::vector<std::pair<int64_t, uint64_t>>, std::greater<std::pair<int64_t, uint64_t>>> RPCDeadlines;
+		//deadline registered with the Worker, 0 if none
+		int64_t																RPCWakeup;
+		uint64_t																RPCSent;
+		uint64_t																RPCReplied;
+		uint64_t																RPCTimeout;
+		uint64_t																RPCCancelled;
+		uint64_t																RPCLate;
+		uint64_t																RPCLatencySum;
+		uint64_t																RPCLatencyMax;
+
+		std::atomic<ModuleStats*>										Stats;
 	};
 
 	Module::Module() noexcept
@@ -65,6 +214,11 @@ namespace moon
 	void Module::SetEnableUpdate(bool v)
 	{
 		m_ModuleImp->EnableUpdate = v;
+		auto owner = m_ModuleImp->Owner.load();
+		if (v && nullptr != owner)
+		{
+			owner->ScheduleUpdate(GetID());
+		}
 	}
 
 	bool Module::IsEnableUpdate()
@@ -72,25 +226,248 @@ namespace moon
 		return m_ModuleImp->EnableUpdate;
 	}
 
-	void Module::Send(ModuleID receiver, const std::string & data, const std::string & userdata, uint64_t rpcID, uint8_t type)
+	void Module::SetUpdateInterval(uint32_t interval)
 	{
-		//if send Message to self , add to MessageQueue directly.
-		if (receiver == GetID())
+		m_ModuleImp->UpdateInterval = interval;
+	}
+
+	uint32_t Module::GetUpdateInterval()
+	{
+		return m_ModuleImp->UpdateInterval;
+	}
+
+	void Module::SetMessageBatch(uint32_t n)
+	{
+		m_ModuleImp->MessageBatch = n;
+	}
+
+	uint32_t Module::GetMessageBatch()
+	{
+		return m_ModuleImp->MessageBatch;
+	}
+
+	void Module::Send(ModuleID receiver, const std::string & data, const std::string & userdata, uint64_t rpcID, uint8_t type, uint8_t priority)
+	{
+		Assert((type != (uint8_t)EMessageType::Unknown), "send unknown type message!");
+
+		auto msg = ObjectCreateHelper<Message>::Create(data.size());
+		msg->SetSender(GetID());
+		msg->SetReceiver(receiver);
+		msg->WriteData(data);
+		msg->SetUserData(userdata);
+		msg->SetRPCID(rpcID);
+		msg->SetType(EMessageType(type));
+		msg->SetPriority(EMessagePriority(priority));
+
+		m_ModuleImp->CountSend(data.size());
+		m_ModuleImp->Manager->DispatchMessage(msg);
+	}
+
+	void Module::Forward(ModuleID receiver, const MessagePtr & msg, const std::string & userdata, uint64_t rpcID, uint8_t type)
+	{
+		//payload is inline, a copy is as cheap as sharing
+		if (nullptr == msg->GetStream())
 		{
-			Assert((type != (uint8_t)EMessageType::Unknown), "send unknown type message!");
+			Send(receiver, std::string((const char*)msg->Data(), msg->Size()), userdata, rpcID, type);
+			return;
+		}
+		m_ModuleImp->CountSend(msg->Size());
+		m_ModuleImp->Manager->SendEx(GetID(), receiver, msg->GetStream(), userdata, rpcID, type);
+	}
 
-			auto msg = ObjectCreateHelper<Message>::Create(data.size());
-			msg->SetSender(GetID());
+	uint64_t Module::SendRPC(ModuleID receiver, const std::string & data, const std::string & userdata, uint32_t timeout)
+	{
+		auto& imp = *m_ModuleImp;
+		auto rpcID = ++imp.RPCIncreID;
+		imp.PendingRPCs.emplace(rpcID, ModuleImp::PendingRPC{ receiver, MicroSecond() });
+		imp.RPCSent++;
+
+		if (0 != timeout)
+		{
+			auto deadline = time::millsecond() + timeout;
+			imp.RPCDeadlines.emplace(deadline, rpcID);
+			//only the earliest deadline is registered with the Worker
+			if (0 == imp.RPCWakeup || deadline < imp.RPCWakeup)
+			{
+				imp.RPCWakeup = deadline;
+				auto owner = imp.Owner.load();
+				//not added yet, the Worker registers GetRPCWakeup when the module starts
+				if (nullptr != owner)
+				{
+					owner->ScheduleRPCTimeout(GetID(), deadline);
+				}
+			}
+		}
+
+		Send(receiver, data, userdata, rpcID, (uint8_t)EMessageType::ModuleData);
+		return rpcID;
+	}
+
+	bool Module::CancelRPC(uint64_t rpcID)
+	{
+		if (m_ModuleImp->PendingRPCs.erase(rpcID) == 0)
+			return false;
+		m_ModuleImp->RPCCancelled++;
+		return true;
+	}
+
+	uint32_t Module::GetPendingRPC()
+	{
+		return static_cast<uint32_t>(m_ModuleImp->PendingRPCs.size());
+	}
+
+	void Module::RegisterName(const std::string & name)
+	{
+		m_ModuleImp->Manager->RegisterName(name, GetID());
+	}
+
+	void Module::UnregisterName(const std::string & name)
+	{
+		m_ModuleImp->Manager->UnregisterName(name, GetID());
+	}
+
+	ModuleID Module::GetModuleByName(const std::string & name)
+	{
+		return m_ModuleImp->Manager->GetModuleByName(name);
+	}
+
+	ModuleID Module::WatchName(const std::string & name)
+	{
+		return m_ModuleImp->Manager->WatchName(name, GetID());
+	}
+
+	void Module::UnwatchName(const std::string & name)
+	{
+		m_ModuleImp->Manager->UnwatchName(name, GetID());
+	}
+
+	static std::string FormatHistogram(const std::string& name, const Histogram& h)
+	{
+		return name + ":" + std::to_string(h.Count())
+			+ ";" + name + "_ns:" + std::to_string(h.Sum())
+			+ ";" + name + "_p50_ns:" + std::to_string(h.Percentile(50))
+			+ ";" + name + "_p99_ns:" + std::to_string(h.Percentile(99))
+			+ ";" + name + "_max_ns:" + std::to_string(h.Max()) + ";";
+	}
+
+	std::string Module::GetStats()
+	{
+		auto s = m_ModuleImp->Stats.load(std::memory_order_acquire);
+		if (nullptr == s)
+			return std::string();
+		return "in:" + std::to_string(s->MessagesIn.load(std::memory_order_relaxed))
+			+ ";out:" + std::to_string(s->MessagesOut.load(std::memory_order_relaxed))
+			+ ";bytes_in:" + std::to_string(s->BytesIn.load(std::memory_order_relaxed))
+			+ ";bytes_out:" + std::to_string(s->BytesOut.load(std::memory_order_relaxed))
+			+ ";queue_max:" + std::to_string(s->QueueMax.load(std::memory_order_relaxed)) + ";"
+			+ FormatHistogram("handle", s->HandleTime)
+			+ FormatHistogram("update", s->UpdateTime);
+	}
+
+	uint64_t Module::GetBusyTime()
+	{
+		auto s = m_ModuleImp->Stats.load(std::memory_order_acquire);
+		if (nullptr == s)
+			return 0;
+		return s->HandleTime.Sum() + s->UpdateTime.Sum();
+	}
+
+	void Module::RunUpdate(uint32_t interval)
+	{
+		auto stats = m_ModuleImp->GetStats();
+		if (nullptr == stats)
+		{
+			Update(interval);
+			return;
+		}
+		auto start = NanoSecond();
+		Update(interval);
+		stats->UpdateTime.Add(NanoSecond() - start);
+	}
+
+	std::string Module::GetRPCStats()
+	{
+		auto& imp = *m_ModuleImp;
+		auto avg = (0 == imp.RPCReplied) ? 0 : imp.RPCLatencySum / imp.RPCReplied;
+		return "pending:" + std::to_string(imp.PendingRPCs.size())
+			+ ";sent:" + std::to_string(imp.RPCSent)
+			+ ";replied:" + std::to_string(imp.RPCReplied)
+			+ ";timeout:" + std::to_string(imp.RPCTimeout)
+			+ ";cancelled:" + std::to_string(imp.RPCCancelled)
+			+ ";late:" + std::to_string(imp.RPCLate)
+			+ ";avg_us:" + std::to_string(avg)
+			+ ";max_us:" + std::to_string(imp.RPCLatencyMax) + ";";
+	}
+
+	bool Module::CompleteRPC(const MessagePtr & msg)
+	{
+		if (msg->GetType() != EMessageType::ModuleRPC || 0 == msg->GetRPCID())
+			return true;
+
+		auto& imp = *m_ModuleImp;
+		auto iter = imp.PendingRPCs.find(msg->GetRPCID());
+		if (iter == imp.PendingRPCs.end())
+		{
+			//answer to a request of this module that timed out or was cancelled
+			if (msg->GetRPCID() <= imp.RPCIncreID)
+			{
+				imp.RPCLate++;
+				return false;
+			}
+			return true;
+		}
+
+		auto latency = static_cast<uint64_t>(MicroSecond() - iter->second.Start);
+		imp.RPCLatencySum += latency;
+		if (latency > imp.RPCLatencyMax)
+		{
+			imp.RPCLatencyMax = latency;
+		}
+		imp.RPCReplied++;
+		imp.PendingRPCs.erase(iter);
+		return true;
+	}
+
+	int64_t Module::CheckRPCTimeout(int64_t deadline, int64_t now)
+	{
+		auto& imp = *m_ModuleImp;
+		//an earlier deadline was registered after this one
+		if (deadline != imp.RPCWakeup)
+			return 0;
+
+		auto& deadlines = imp.RPCDeadlines;
+		while (!deadlines.empty() && deadlines.top().first <= now)
+		{
+			auto rpcID = deadlines.top().second;
+			deadlines.pop();
+
+			auto iter = imp.PendingRPCs.find(rpcID);
+			if (iter == imp.PendingRPCs.end())
+				continue;
+
+			auto msg = ObjectCreateHelper<Message>::Create(0);
+			msg->SetSender(iter->second.Receiver);
 			msg->SetReceiver(GetID());
-			msg->WriteData(data);
-			msg->SetUserData(userdata);
 			msg->SetRPCID(rpcID);
-			msg->SetType(EMessageType(type));
+			msg->SetType(EMessageType::ModuleRPCTimeout);
+			imp.PendingRPCs.erase(iter);
+			imp.RPCTimeout++;
 
-			PushMessage(msg);
-			return;
+			imp.Manager->DispatchMessage(msg);
+		}
+
+		while (!deadlines.empty() && imp.PendingRPCs.find(deadlines.top().second) == imp.PendingRPCs.end())
+		{
+			deadlines.pop();
 		}
-		m_ModuleImp->Manager->Send(GetID(), receiver, data, userdata, rpcID, type);
+
+		imp.RPCWakeup = deadlines.empty() ? 0 : deadlines.top().first;
+		return imp.RPCWakeup;
+	}
+
+	int64_t Module::GetRPCWakeup()
+	{
+		return m_ModuleImp->RPCWakeup;
 	}
 
 	void Module::SendByCache(ModuleID receiver, uint32_t cacheID, const std::string & userdata, uint64_t rpcID, uint8_t type)
@@ -111,17 +488,36 @@ namespace moon
 			msg->SetType(EMessageType(type));
 			msg->SetRPCID(rpcID);
 
-			PushMessage(msg);
+			m_ModuleImp->CountSend(ms->Size());
+			m_ModuleImp->Manager->DispatchMessage(msg);
 			return;
 		}
+		m_ModuleImp->CountSend(ms->Size());
 		m_ModuleImp->Manager->SendEx(GetID(), receiver,ms, userdata, rpcID, type);
 	}
 
 	void Module::Broadcast(const std::string& data, const std::string& userdata,uint8_t type)
 	{
+		m_ModuleImp->CountSend(data.size());
 		m_ModuleImp->Manager->Broadcast(GetID(),data, userdata, type);
 	}
 
+	void Module::Subscribe(uint32_t topic)
+	{
+		m_ModuleImp->Manager->Subscribe(topic, GetID());
+	}
+
+	void Module::Unsubscribe(uint32_t topic)
+	{
+		m_ModuleImp->Manager->Unsubscribe(topic, GetID());
+	}
+
+	uint32_t Module::Publish(uint32_t topic, const std::string & data, const std::string & userdata, uint8_t type)
+	{
+		m_ModuleImp->CountSend(data.size());
+		return m_ModuleImp->Manager->Publish(GetID(), topic, data, userdata, type);
+	}
+
 	uint32_t Module::CreateCache(const std::string & data)
 	{
 		auto ms = ObjectCreateHelper<MemoryStream>::Create(data.size());
@@ -135,6 +531,31 @@ namespace moon
 		m_ModuleImp->Manager = mgr;
 	}
 
+	ModuleManager* Module::GetManager()
+	{
+		return m_ModuleImp->Manager;
+	}
+
+	void Module::SetWorker(Worker* w)
+	{
+		m_ModuleImp->Owner = w;
+	}
+
+	Worker* Module::GetWorker()
+	{
+		return m_ModuleImp->Owner.load();
+	}
+
+	void Module::SetPinned(bool v)
+	{
+		m_ModuleImp->Pinned = v;
+	}
+
+	bool Module::IsPinned()
+	{
+		return m_ModuleImp->Pinned.load();
+	}
+
 	void Module::Exit()
 	{
 		m_ModuleImp->Manager->RemoveModule(GetID());
@@ -156,27 +577,114 @@ namespace moon
 		return m_ModuleImp->Ok;
 	}
 
-	void Module::PushMessage(const MessagePtr& msg)
+	bool Module::PushMessage(const MessagePtr& msg)
 	{
-		m_ModuleImp->MessageQueue.push_back(msg);
+		if (msg->GetPriority() == EMessagePriority::High)
+		{
+			m_ModuleImp->HighQueue.PushBack(msg);
+		}
+		else
+		{
+			m_ModuleImp->MessageQueue.PushBack(msg);
+		}
+		return !m_ModuleImp->Scheduled.exchange(true);
 	}
 
 	bool Module::PeekMessage()
 	{
-		auto& mq = m_ModuleImp->MessageQueue;
+		auto& imp = *m_ModuleImp;
 
-		if (mq.size() == 0)
-			return false;
-		auto& msg = mq.front();
-		assert(GetID() == msg->GetReceiver() || msg->GetReceiver() == 0);
-		OnMessage(msg->GetSender(),msg->Bytes(),msg->GetUserData(),msg->GetRPCID(),(uint8_t)msg->GetType());
-		mq.pop_front();
-		return mq.size() != 0;
+		auto stats = imp.GetStats();
+		if (nullptr != stats)
+		{
+			uint64_t depth = GetMQSize();
+			if (depth > stats->QueueMax.load(std::memory_order_relaxed))
+			{
+				stats->QueueMax.store(depth, std::memory_order_relaxed);
+			}
+		}
+
+		MessagePtr msg;
+		if (imp.MessageBatch > 1)
+		{
+			uint64_t traceID = 0;
+			auto& batch = imp.Batch;
+			while (batch.size() < imp.MessageBatch && imp.PopMessage(msg))
+			{
+				assert(GetID() == msg->GetReceiver() || msg->GetReceiver() == 0);
+				if (CompleteRPC(msg))
+				{
+					Tracer::Instant(msg->GetTraceID(), "dispatch", GetID());
+					if (0 == traceID)
+					{
+						traceID = msg->GetTraceID();
+					}
+					batch.push_back(std::move(msg));
+				}
+			}
+
+			if (!batch.empty())
+			{
+				//a batch is handled in one call, it is traced as the first traced message in it
+				Tracer::Scope scope(traceID, "handle", GetID());
+				auto start = (nullptr != stats) ? NanoSecond() : 0;
+				OnMessageBatch(batch);
+				if (nullptr != stats)
+				{
+					stats->HandleTime.Add(NanoSecond() - start);
+					ModuleStats::Add(stats->MessagesIn, batch.size());
+					for (auto& m : batch)
+					{
+						ModuleStats::Add(stats->BytesIn, m->Size());
+					}
+				}
+				batch.clear();
+				if (!imp.Empty())
+					return true;
+			}
+		}
+		else if (imp.PopMessage(msg))
+		{
+			assert(GetID() == msg->GetReceiver() || msg->GetReceiver() == 0);
+			if (CompleteRPC(msg))
+			{
+				Tracer::Instant(msg->GetTraceID(), "dispatch", GetID());
+				Tracer::Scope scope(msg->GetTraceID(), "handle", GetID());
+				auto start = (nullptr != stats) ? NanoSecond() : 0;
+				OnMessageEx(msg);
+				if (nullptr != stats)
+				{
+					stats->HandleTime.Add(NanoSecond() - start);
+					ModuleStats::Add(stats->MessagesIn, 1);
+					ModuleStats::Add(stats->BytesIn, msg->Size());
+				}
+			}
+			if (!imp.Empty())
+				return true;
+		}
+
+		//mailbox is empty, leave the ready queue. a sender may have pushed
+		//between the check and the store, so check again.
+		imp.Scheduled = false;
+		return !imp.Empty() && !imp.Scheduled.exchange(true);
+	}
+
+	void Module::OnMessageEx(const MessagePtr& msg)
+	{
+		OnMessage(msg->GetSender(), msg->Bytes(), msg->GetUserData(), msg->GetRPCID(), (uint8_t)msg->GetType());
+	}
+
+	void Module::OnMessageBatch(const std::vector<MessagePtr>& msgs)
+	{
+		for (auto& msg : msgs)
+		{
+			OnMessageEx(msg);
+		}
 	}
 
 	size_t Module::GetMQSize()
 	{
-		return m_ModuleImp->MessageQueue.size();
+		return m_ModuleImp->MessageQueue.Size() + m_ModuleImp->HighQueue.Size();
 	}
 }
 
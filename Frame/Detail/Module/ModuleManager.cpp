@@ -9,18 +9,39 @@ Licensed under the MIT License <http://opensource.org/licenses/MIT>.
 
 #include "ModuleManager.h"
 #include "Worker.h"
+#include "Cluster.h"
 #include "Message.h"
 #include "Module.h"
+#include "Network.h"
 #include "Detail/Log/Log.h"
 #include "Common/StringUtils.hpp"
 #include "ObjectCreateHelper.h"
+#include "Tracer.h"
+#include <future>
+#include <fstream>
+#include <algorithm>
 
 namespace moon
 {
+	//名字表的版本号在所有 ModuleManager 之间递增, 线程本地缓存不会把新的 ModuleManager 误认为旧的
+	static std::atomic<uint64_t> NameVersionCounter(0);
+
 	ModuleManager::ModuleManager()
 		:m_nextWorker(0)
 		,m_IncreaseModuleID(1)
+		,m_MigrateThreshold(0)
+		,m_MigrateCount(0)
+		,m_ModuleBudget(64)
+		,m_TimeBudget(10)
+		,m_YieldCount(0)
+		,m_BlockingSleepCount(0)
+		,m_BlockingSleepTime(0)
+		,m_ReloadCount(0)
+		,m_LastReloadTime(0)
+		,m_ModuleStats(false)
 		,m_MachineID(1)
+		,m_ModuleNames(std::make_shared<NameTable>())
+		,m_NameVersion(0)
 	{
 
 	}
@@ -64,9 +85,34 @@ namespace moon
 			m_MachineID = 0;
 		}
 
+		if (contains_key(kv_config, "migrate_threshold"))
+		{
+			m_MigrateThreshold = string_utils::string_convert<uint32_t>(kv_config["migrate_threshold"]);
+		}
+
+		if (contains_key(kv_config, "module_budget"))
+		{
+			m_ModuleBudget = string_utils::string_convert<uint32_t>(kv_config["module_budget"]);
+		}
+
+		if (contains_key(kv_config, "turn_budget"))
+		{
+			m_TimeBudget = string_utils::string_convert<uint32_t>(kv_config["turn_budget"]);
+		}
+
+		if (contains_key(kv_config, "module_stats"))
+		{
+			m_ModuleStats = (string_utils::string_convert<uint32_t>(kv_config["module_stats"]) != 0);
+		}
+
+		if (contains_key(kv_config, "trace_sample"))
+		{
+			SetTraceSample(string_utils::string_convert<uint32_t>(kv_config["trace_sample"]));
+		}
+
 		for (uint8_t i = 0; i != workerNum; i++)
 		{
-			auto wk = std::make_shared<Worker>();
+			auto wk = std::make_shared<Worker>(this);
 			m_Workers.push_back(wk);
 			wk->SetID(i);
 		}
@@ -81,13 +127,32 @@ namespace moon
 
 	void ModuleManager::RemoveModule(ModuleID id)
 	{
-		uint8_t workerID = GetWorkerID(id);
-		if (workerID < m_Workers.size())
+		auto module = FindModule(id);
+		if (nullptr != module)
+		{
+			module->GetWorker()->RemoveModule(id);
+		}
+	}
+
+	void ModuleManager::ReloadModule(ModuleID id)
+	{
+		auto module = FindModule(id);
+		if (nullptr != module)
 		{
-			m_Workers[workerID]->RemoveModule(id);
+			module->GetWorker()->ReloadModule(id);
 		}
 	}
 
+	uint64_t ModuleManager::GetReloadCount()
+	{
+		return m_ReloadCount.load();
+	}
+
+	uint64_t ModuleManager::GetLastReloadTime()
+	{
+		return m_LastReloadTime.load();
+	}
+
 	void ModuleManager::Send(ModuleID sender, ModuleID receiver, const std::string & data, const std::string & userdata, uint64_t rpcID, uint8_t type)
 	{
 		Assert((type != (uint8_t)EMessageType::Unknown), "send unknown type message!");
@@ -100,11 +165,7 @@ namespace moon
 		msg->SetRPCID(rpcID);
 		msg->SetType(EMessageType(type));
 	
-		uint8_t workerID = GetWorkerID(receiver);
-		if (workerID < m_Workers.size())
-		{
-			m_Workers[workerID]->DispatchMessage(msg);
-		}
+		DispatchMessage(msg);
 	}
 
 	void ModuleManager::SendEx(ModuleID sender, ModuleID receiver, const MemoryStreamPtr & data, const std::string & userdata, uint64_t rpcID, uint8_t type)
@@ -118,28 +179,399 @@ namespace moon
 		msg->SetRPCID(rpcID);
 		msg->SetType(EMessageType(type));
 
-		uint8_t workerID = GetWorkerID(receiver);
-		if (workerID < m_Workers.size())
+		DispatchMessage(msg);
+	}
+
+	void ModuleManager::Broadcast(ModuleID sender, const std::string & data, const std::string & userdata, uint8_t type)
+	{
+		Assert((type != (uint8_t)EMessageType::Unknown), "send unknown type message!");
+
+		auto msg = ObjectCreateHelper<Message>::Create(data.size());
+		msg->SetSender(sender);
+		msg->SetReceiver(0);
+		msg->WriteData(data);
+		msg->SetUserData(userdata);
+		msg->SetType(EMessageType(type));
+		msg->SetTraceID(Tracer::Current());
+
+		std::shared_lock<std::shared_timed_mutex> lck(m_DirectoryLock);
+		for (auto& iter : m_Directory)
 		{
-			m_Workers[workerID]->DispatchMessage(msg);
+			if (iter.first == sender)
+				continue;
+			if (iter.second->PushMessage(msg))
+			{
+				iter.second->GetWorker()->Schedule(iter.second);
+			}
 		}
 	}
 
-	void ModuleManager::Broadcast(ModuleID sender, const std::string & data, const std::string & userdata, uint8_t type)
+	void ModuleManager::Subscribe(uint32_t topic, ModuleID moduleID)
+	{
+		std::unique_lock<std::shared_timed_mutex> lck(m_TopicsLock);
+		auto& subscribers = m_Topics[topic];
+		if (nullptr != subscribers && std::find(subscribers->begin(), subscribers->end(), moduleID) != subscribers->end())
+			return;
+
+		auto v = (nullptr != subscribers) ? std::make_shared<std::vector<ModuleID>>(*subscribers) : std::make_shared<std::vector<ModuleID>>();
+		v->push_back(moduleID);
+		subscribers = v;
+	}
+
+	void ModuleManager::Unsubscribe(uint32_t topic, ModuleID moduleID)
+	{
+		std::unique_lock<std::shared_timed_mutex> lck(m_TopicsLock);
+		auto iter = m_Topics.find(topic);
+		if (iter == m_Topics.end())
+			return;
+
+		auto v = std::make_shared<std::vector<ModuleID>>(*iter->second);
+		v->erase(std::remove(v->begin(), v->end(), moduleID), v->end());
+		if (v->empty())
+		{
+			m_Topics.erase(iter);
+		}
+		else
+		{
+			iter->second = v;
+		}
+	}
+
+	uint32_t ModuleManager::Publish(ModuleID sender, uint32_t topic, const std::string & data, const std::string & userdata, uint8_t type)
 	{
 		Assert((type != (uint8_t)EMessageType::Unknown), "send unknown type message!");
 
+		std::shared_ptr<const std::vector<ModuleID>> subscribers;
+		{
+			std::shared_lock<std::shared_timed_mutex> lck(m_TopicsLock);
+			auto iter = m_Topics.find(topic);
+			if (iter == m_Topics.end())
+				return 0;
+			subscribers = iter->second;
+		}
+
 		auto msg = ObjectCreateHelper<Message>::Create(data.size());
 		msg->SetSender(sender);
 		msg->SetReceiver(0);
 		msg->WriteData(data);
 		msg->SetUserData(userdata);
 		msg->SetType(EMessageType(type));
+		msg->SetTraceID(Tracer::Current());
+
+		uint32_t count = 0;
+		std::shared_lock<std::shared_timed_mutex> lck(m_DirectoryLock);
+		for (auto id : *subscribers)
+		{
+			if (id == sender)
+				continue;
+			auto iter = m_Directory.find(id);
+			if (iter == m_Directory.end())
+				continue;
+			if (iter->second->PushMessage(msg))
+			{
+				iter->second->GetWorker()->Schedule(iter->second);
+			}
+			count++;
+		}
+		return count;
+	}
+
+	void ModuleManager::DispatchMessage(const MessagePtr & msg)
+	{
+		//处理追踪的消息时发送的消息继承它的 TraceID
+		if (0 == msg->GetTraceID())
+		{
+			msg->SetTraceID(Tracer::Current());
+		}
+		Tracer::Instant(msg->GetTraceID(), "send", msg->GetReceiver());
+
+		uint8_t machineID = (msg->GetReceiver() >> 24) & 0xFF;
+		if (machineID != m_MachineID && nullptr != m_Cluster)
+		{
+			m_Cluster->Send(msg);
+			return;
+		}
+
+		auto module = FindModule(msg->GetReceiver());
+		//PushMessage 之后再读取所在的 Worker, 迁移中的 Module 已经在就绪队列中
+		if (nullptr != module && module->PushMessage(msg))
+		{
+			module->GetWorker()->Schedule(module);
+		}
+	}
 
+	void ModuleManager::ListenCluster(const std::string & ip, const std::string & port)
+	{
+		GetCluster()->Listen(ip, port);
+	}
+
+	void ModuleManager::AddClusterPeer(uint8_t machineID, const std::string & ip, const std::string & port)
+	{
+		GetCluster()->AddPeer(machineID, ip, port);
+	}
+
+	void ModuleManager::SetModuleStats(bool enable)
+	{
+		m_ModuleStats = enable;
+	}
+
+	bool ModuleManager::IsModuleStatsEnabled()
+	{
+		return m_ModuleStats.load(std::memory_order_relaxed);
+	}
+
+	std::string ModuleManager::GetModuleStats(ModuleID moduleID)
+	{
+		auto module = FindModule(moduleID);
+		if (nullptr == module)
+			return std::string();
+		return module->GetStats();
+	}
+
+	std::string ModuleManager::DumpModuleStats()
+	{
+		std::vector<ModulePtr> modules;
+		{
+			std::shared_lock<std::shared_timed_mutex> lck(m_DirectoryLock);
+			for (auto& iter : m_Directory)
+			{
+				modules.push_back(iter.second);
+			}
+		}
+
+		std::vector<std::pair<uint64_t, ModulePtr>> sorted;
+		for (auto& m : modules)
+		{
+			sorted.emplace_back(m->GetBusyTime(), m);
+		}
+		std::sort(sorted.begin(), sorted.end(), [](const std::pair<uint64_t, ModulePtr>& a, const std::pair<uint64_t, ModulePtr>& b) {
+			return a.first > b.first;
+		});
+
+		std::string content;
+		for (auto& it : sorted)
+		{
+			auto& m = it.second;
+			auto worker = m->GetWorker();
+			auto line = m->GetName() + ":" + std::to_string(m->GetID())
+				+ " worker:" + std::to_string((nullptr != worker) ? worker->GetID() : 0)
+				+ " " + m->GetStats();
+			CONSOLE_INFO("%s", line.c_str());
+			content += line;
+			content += "\n";
+		}
+		return content;
+	}
+
+	std::string ModuleManager::DumpPlacement()
+	{
+		std::vector<std::vector<ModulePtr>> placement(m_Workers.size());
+		{
+			std::shared_lock<std::shared_timed_mutex> lck(m_DirectoryLock);
+			for (auto& iter : m_Directory)
+			{
+				auto worker = iter.second->GetWorker();
+				if (nullptr != worker)
+				{
+					placement[worker->GetID()].push_back(iter.second);
+				}
+			}
+		}
+
+		std::string content;
 		for (auto& w : m_Workers)
 		{
-			w->Broadcast(msg);
+			auto& modules = placement[w->GetID()];
+			std::sort(modules.begin(), modules.end(), [](const ModulePtr& a, const ModulePtr& b) {
+				return a->GetID() < b->GetID();
+			});
+
+			auto line = "worker:" + std::to_string(w->GetID()) + (w->IsDedicated() ? " dedicated" : "") + " modules:";
+			for (auto& m : modules)
+			{
+				line += " " + m->GetName() + ":" + std::to_string(m->GetID());
+				if (m->IsPinned())
+				{
+					line += "*";
+				}
+			}
+			CONSOLE_INFO("%s", line.c_str());
+			content += line;
+			content += "\n";
+		}
+		return content;
+	}
+
+	void ModuleManager::SetTraceSample(uint32_t n)
+	{
+		Tracer::SetSampleRate(n);
+	}
+
+	uint32_t ModuleManager::GetTraceSample()
+	{
+		return Tracer::GetSampleRate();
+	}
+
+	bool ModuleManager::DumpTrace(const std::string & path)
+	{
+		std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+		if (!ofs.is_open())
+		{
+			CONSOLE_WARN("DumpTrace: can not open file %s", path.c_str());
+			return false;
+		}
+		ofs << Tracer::Export(m_MachineID);
+		return ofs.good();
+	}
+
+	void ModuleManager::RegisterName(const std::string & name, ModuleID moduleID)
+	{
+		Assert(0 != moduleID, "ModuleManager::RegisterName: module id can not be 0");
+
+		std::lock_guard<std::mutex> lck(m_ModuleNamesLock);
+		auto iter = m_ModuleNames->find(name);
+		if (iter != m_ModuleNames->end() && iter->second == moduleID)
+			return;
+
+		auto names = std::make_shared<NameTable>(*m_ModuleNames);
+		(*names)[name] = moduleID;
+		PublishNames(names);
+
+		auto w = m_NameWatchers.find(name);
+		if (w != m_NameWatchers.end())
+		{
+			NotifyName(name, moduleID, w->second);
+		}
+	}
+
+	void ModuleManager::UnregisterName(const std::string & name, ModuleID moduleID)
+	{
+		std::lock_guard<std::mutex> lck(m_ModuleNamesLock);
+		auto iter = m_ModuleNames->find(name);
+		if (iter == m_ModuleNames->end() || iter->second != moduleID)
+			return;
+
+		auto names = std::make_shared<NameTable>(*m_ModuleNames);
+		names->erase(name);
+		PublishNames(names);
+
+		auto w = m_NameWatchers.find(name);
+		if (w != m_NameWatchers.end())
+		{
+			NotifyName(name, 0, w->second);
+		}
+	}
+
+	ModuleID ModuleManager::GetModuleByName(const std::string & name)
+	{
+		struct NameCache
+		{
+			uint64_t										Version = 0;
+			std::shared_ptr<const NameTable>	Names;
+		};
+		thread_local NameCache cache;
+
+		auto version = m_NameVersion.load(std::memory_order_acquire);
+		if (0 == version)
+			return 0;
+
+		//快照先于版本号发布, 读到新版本号时一定能读到不旧于它的快照
+		if (cache.Version != version)
+		{
+			cache.Names = std::atomic_load(&m_ModuleNames);
+			cache.Version = version;
+		}
+
+		auto iter = cache.Names->find(name);
+		if (iter != cache.Names->end())
+		{
+			return iter->second;
+		}
+		return 0;
+	}
+
+	ModuleID ModuleManager::WatchName(const std::string & name, ModuleID watcher)
+	{
+		std::lock_guard<std::mutex> lck(m_ModuleNamesLock);
+		auto& watchers = m_NameWatchers[name];
+		if (std::find(watchers.begin(), watchers.end(), watcher) == watchers.end())
+		{
+			watchers.push_back(watcher);
+		}
+
+		auto iter = m_ModuleNames->find(name);
+		if (iter != m_ModuleNames->end())
+		{
+			return iter->second;
 		}
+		return 0;
+	}
+
+	void ModuleManager::UnwatchName(const std::string & name, ModuleID watcher)
+	{
+		std::lock_guard<std::mutex> lck(m_ModuleNamesLock);
+		auto iter = m_NameWatchers.find(name);
+		if (iter == m_NameWatchers.end())
+			return;
+
+		auto& watchers = iter->second;
+		watchers.erase(std::remove(watchers.begin(), watchers.end(), watcher), watchers.end());
+		if (watchers.empty())
+		{
+			m_NameWatchers.erase(iter);
+		}
+	}
+
+	void ModuleManager::SetMigrateThreshold(uint32_t threshold)
+	{
+		m_MigrateThreshold = threshold;
+	}
+
+	uint32_t ModuleManager::GetMigrateThreshold()
+	{
+		return m_MigrateThreshold.load();
+	}
+
+	uint64_t ModuleManager::GetMigrateCount()
+	{
+		return m_MigrateCount.load();
+	}
+
+	void ModuleManager::SetTurnBudget(uint32_t moduleBudget, uint32_t timeBudget)
+	{
+		m_ModuleBudget = moduleBudget;
+		m_TimeBudget = timeBudget;
+	}
+
+	uint32_t ModuleManager::GetModuleBudget()
+	{
+		return m_ModuleBudget.load();
+	}
+
+	uint32_t ModuleManager::GetTimeBudget()
+	{
+		return m_TimeBudget.load();
+	}
+
+	uint64_t ModuleManager::GetYieldCount()
+	{
+		return m_YieldCount.load();
+	}
+
+	void ModuleManager::AddBlockingSleep(uint32_t ms)
+	{
+		m_BlockingSleepCount++;
+		m_BlockingSleepTime += ms;
+	}
+
+	uint64_t ModuleManager::GetBlockingSleepCount()
+	{
+		return m_BlockingSleepCount.load();
+	}
+
+	uint64_t ModuleManager::GetBlockingSleepTime()
+	{
+		return m_BlockingSleepTime.load();
 	}
 
 	void ModuleManager::Run()
@@ -149,47 +581,353 @@ namespace moon
 		{
 			w->Run();
 		}
+
+		if (nullptr != m_Cluster)
+		{
+			m_Cluster->Run();
+		}
 	}
 
 	void ModuleManager::Stop()
 	{
+		if (nullptr != m_Cluster)
+		{
+			m_Cluster->Stop();
+		}
+
+		//停止迁移，并等待已经开始的迁移投递到目标 Worker
+		m_MigrateThreshold = 0;
+		for (auto& w : m_Workers)
+		{
+			//没有 Run 或者已经停止的 Worker 不会处理投递的事件
+			if (!w->IsRunning())
+				continue;
+			std::promise<void> done;
+			w->Post([&done]() {done.set_value(); });
+			w->Notify();
+			done.get_future().wait();
+		}
+
 		for (auto& w : m_Workers)
 		{
 			w->Stop();
 		}
+
+		//Module 的 Network 在 Destory 时开始的优雅关闭
+		Network::WaitDrain();
+
+		std::unique_lock<std::shared_timed_mutex> lck(m_DirectoryLock);
+		m_Directory.clear();
 		CONSOLE_TRACE("ModuleManager stop");
 	}
 
 	uint8_t ModuleManager::GetNextWorkerID()
 	{
-		if (m_nextWorker < m_Workers.size())
+		for (size_t i = 0; i < m_Workers.size(); i++)
 		{
+			if (m_nextWorker >= m_Workers.size())
+			{
+				m_nextWorker = 0;
+			}
 			uint8_t tmp = m_nextWorker.load();
 			m_nextWorker++;
 			if (m_nextWorker == m_Workers.size())
 			{
 				m_nextWorker = 0;
 			}
-			return tmp;
+			if (!m_Workers[tmp]->IsDedicated())
+			{
+				return tmp;
+			}
 		}
 		return 0;
 	}
 
-	void ModuleManager::AddModuleToWorker(uint8_t workerid, const ModulePtr& module)
+	uint8_t ModuleManager::SelectWorker(const std::string & config, EPlacement & placement, ModuleID & colocate)
+	{
+		placement = EPlacement::Any;
+		colocate = 0;
+
+		std::unordered_map<std::string, std::string> kv_config;
+		auto vec = string_utils::split<std::string>(config, ";");
+		for (auto& it : vec)
+		{
+			string_utils::trimleft(it);
+			string_utils::trimright(it);
+			auto pairs = string_utils::split<std::string>(it, ":");
+			if (pairs.size() == 2)
+			{
+				kv_config.emplace(pairs[0], pairs[1]);
+			}
+		}
+
+		if (contains_key(kv_config, "worker"))
+		{
+			auto id = string_utils::string_convert<int>(kv_config["worker"]);
+			if (id < 0 || id >= (int)m_Workers.size() || m_Workers[id]->IsDedicated())
+			{
+				CONSOLE_WARN("CreateModule: worker [%s] is not available, use round robin.", kv_config["worker"].c_str());
+				return GetNextWorkerID();
+			}
+			placement = EPlacement::Pinned;
+			return (uint8_t)id;
+		}
+
+		if (contains_key(kv_config, "dedicated") && (kv_config["dedicated"] == "true" || kv_config["dedicated"] == "1"))
+		{
+			//选择没有 Module 的普通 Worker
+			std::lock_guard<std::mutex> placementLck(m_PlacementLock);
+			std::vector<uint32_t> counts(m_Workers.size(), 0);
+			{
+				std::shared_lock<std::shared_timed_mutex> lck(m_DirectoryLock);
+				for (auto& iter : m_Directory)
+				{
+					auto worker = iter.second->GetWorker();
+					if (nullptr != worker)
+					{
+						counts[worker->GetID()]++;
+					}
+				}
+			}
+
+			int selected = -1;
+			uint32_t normal = 0;
+			for (auto& w : m_Workers)
+			{
+				if (w->IsDedicated())
+					continue;
+				normal++;
+				if (selected < 0 && 0 == counts[w->GetID()])
+				{
+					selected = w->GetID();
+				}
+			}
+
+			if (selected < 0 || normal < 2)
+			{
+				CONSOLE_WARN("CreateModule: no empty worker left for dedicated module, use round robin.");
+				return GetNextWorkerID();
+			}
+			//选中时立即预留, Init 失败时由 CancelPlacement 释放
+			m_Workers[selected]->SetDedicated(true);
+			placement = EPlacement::Dedicated;
+			return (uint8_t)selected;
+		}
+
+		if (contains_key(kv_config, "colocate"))
+		{
+			auto& name = kv_config["colocate"];
+			auto target = FindModule(GetModuleByName(name));
+			if (nullptr == target)
+			{
+				std::shared_lock<std::shared_timed_mutex> lck(m_DirectoryLock);
+				for (auto& iter : m_Directory)
+				{
+					if (iter.second->GetName() == name)
+					{
+						target = iter.second;
+						break;
+					}
+				}
+			}
+
+			if (nullptr == target)
+			{
+				CONSOLE_WARN("CreateModule: colocate module [%s] not found, use round robin.", name.c_str());
+				return GetNextWorkerID();
+			}
+
+			auto worker = target->GetWorker();
+			if (nullptr != worker && worker->IsDedicated())
+			{
+				CONSOLE_WARN("CreateModule: colocate module [%s] is on dedicated worker, use round robin.", name.c_str());
+				return GetNextWorkerID();
+			}
+			if (nullptr != worker)
+			{
+				//目标在 AddModuleToWorker 中固定
+				placement = EPlacement::Pinned;
+				colocate = target->GetID();
+				return worker->GetID();
+			}
+		}
+
+		return GetNextWorkerID();
+	}
+
+	void ModuleManager::AddModuleToWorker(uint8_t workerid, const ModulePtr& module, EPlacement placement, ModuleID colocate)
 	{
+		std::lock_guard<std::mutex> placementLck(m_PlacementLock);
+		//迁移也持有 m_PlacementLock, 目标固定之后不再移动, 两个 Module 都不再迁移
+		if (0 != colocate)
+		{
+			auto target = FindModule(colocate);
+			auto worker = (nullptr != target) ? target->GetWorker() : nullptr;
+			if (nullptr != worker && !worker->IsDedicated())
+			{
+				target->SetPinned(true);
+				workerid = worker->GetID();
+			}
+			else
+			{
+				CONSOLE_WARN("CreateModule: colocate module [%u] is gone or dedicated, use round robin.", colocate);
+				workerid = GetNextWorkerID();
+				placement = EPlacement::Any;
+			}
+		}
+
+		//选择之后 Worker 可能被并发的 CreateModule 预留为专用 Worker
+		if (placement != EPlacement::Dedicated && workerid < m_Workers.size() && m_Workers[workerid]->IsDedicated())
+		{
+			CONSOLE_WARN("CreateModule: worker [%d] became dedicated, use round robin.", workerid);
+			workerid = GetNextWorkerID();
+			placement = EPlacement::Any;
+		}
+
 		for (auto& wk : m_Workers)
 		{
 			if (wk->GetID() == workerid)
 			{
+				if (placement != EPlacement::Any)
+				{
+					module->SetPinned(true);
+				}
+				module->SetWorker(wk.get());
+				{
+					std::unique_lock<std::shared_timed_mutex> lck(m_DirectoryLock);
+					m_Directory.emplace(module->GetID(), module);
+				}
 				wk->AddModule(module);
 				return;
 			}
 		}
 	}
 
-	uint8_t ModuleManager::GetWorkerID(ModuleID actorID)
+	void ModuleManager::CancelPlacement(uint8_t workerid, EPlacement placement)
+	{
+		std::lock_guard<std::mutex> placementLck(m_PlacementLock);
+		if (placement == EPlacement::Dedicated && workerid < m_Workers.size())
+		{
+			m_Workers[workerid]->SetDedicated(false);
+		}
+	}
+
+	ModulePtr ModuleManager::FindModule(ModuleID id)
+	{
+		std::shared_lock<std::shared_timed_mutex> lck(m_DirectoryLock);
+		auto iter = m_Directory.find(id);
+		if (iter != m_Directory.end())
+		{
+			return iter->second;
+		}
+		return nullptr;
+	}
+
+	void ModuleManager::EraseModule(ModuleID id)
+	{
+		{
+			std::unique_lock<std::shared_timed_mutex> lck(m_DirectoryLock);
+			m_Directory.erase(id);
+		}
+
+		{
+			std::unique_lock<std::shared_timed_mutex> lck(m_TopicsLock);
+			for (auto iter = m_Topics.begin(); iter != m_Topics.end();)
+			{
+				auto& subscribers = *iter->second;
+				if (std::find(subscribers.begin(), subscribers.end(), id) == subscribers.end())
+				{
+					++iter;
+					continue;
+				}
+
+				auto v = std::make_shared<std::vector<ModuleID>>(subscribers);
+				v->erase(std::remove(v->begin(), v->end(), id), v->end());
+				if (v->empty())
+				{
+					iter = m_Topics.erase(iter);
+				}
+				else
+				{
+					iter->second = v;
+					++iter;
+				}
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> lck(m_ModuleNamesLock);
+			for (auto iter = m_NameWatchers.begin(); iter != m_NameWatchers.end();)
+			{
+				auto& watchers = iter->second;
+				watchers.erase(std::remove(watchers.begin(), watchers.end(), id), watchers.end());
+				if (watchers.empty())
+				{
+					iter = m_NameWatchers.erase(iter);
+				}
+				else
+				{
+					++iter;
+				}
+			}
+
+			std::shared_ptr<NameTable> names;
+			std::vector<std::string> unbound;
+			for (auto& it : *m_ModuleNames)
+			{
+				if (it.second != id)
+					continue;
+
+				if (nullptr == names)
+				{
+					names = std::make_shared<NameTable>(*m_ModuleNames);
+				}
+				names->erase(it.first);
+				unbound.push_back(it.first);
+			}
+
+			if (nullptr != names)
+			{
+				PublishNames(names);
+			}
+
+			for (auto& name : unbound)
+			{
+				auto w = m_NameWatchers.find(name);
+				if (w != m_NameWatchers.end())
+				{
+					NotifyName(name, 0, w->second);
+				}
+			}
+		}
+	}
+
+	const ClusterPtr& ModuleManager::GetCluster()
 	{
-		return ((actorID >> 16) & 0xFF);
+		if (nullptr == m_Cluster)
+		{
+			m_Cluster = std::make_shared<Cluster>(this);
+		}
+		return m_Cluster;
+	}
+
+	void ModuleManager::PublishNames(const std::shared_ptr<const NameTable>& names)
+	{
+		std::atomic_store(&m_ModuleNames, names);
+		m_NameVersion.store(++NameVersionCounter, std::memory_order_release);
+	}
+
+	void ModuleManager::NotifyName(const std::string & name, ModuleID moduleID, const std::vector<ModuleID>& watchers)
+	{
+		for (auto watcher : watchers)
+		{
+			auto msg = ObjectCreateHelper<Message>::Create(name.size());
+			msg->SetSender(moduleID);
+			msg->SetReceiver(watcher);
+			msg->WriteData(name);
+			msg->SetType(EMessageType::ModuleNameChanged);
+			DispatchMessage(msg);
+		}
 	}
 
 };
@@ -5,6 +5,10 @@
 #include "Common/TupleUtils.hpp"
 #include "Common/BinaryWriter.hpp"
 #include "Message.h"
+#include "Common/StringUtils.hpp"
+#include "Tracer.h"
+#include <thread>
+#include <condition_variable>
 
 
 
@@ -13,11 +17,18 @@ namespace moon
 
 	DECLARE_SHARED_PTR(Message)
 
+	//优雅关闭在单独的线程中等待, 不阻塞 Destory 所在的 Worker
+	static std::mutex DrainLock;
+	static std::condition_variable DrainCond;
+	static uint32_t DrainCount = 0;
+
 	struct Network::NetworkImp
 	{
 		NetworkImp(int netThreadNum)
+			:DrainTimeout(0)
 		{
 			Net = std::make_shared<NetWorkFrame>(make_bind(&NetworkImp::OnNetMessage, this), netThreadNum);
+			Net->SetBacklogProbe([this]() { return NetMsgQueue.Size(); });
 		}
 
 		void OnNetMessage(ESocketMessageType type, SessionID sessionID, const MemoryStreamPtr& data)
@@ -35,6 +46,12 @@ namespace moon
 			case ESocketMessageType::RecvData:
 			{
 				msg->SetType(EMessageType::NetworkData);
+				auto traceID = Tracer::Sample();
+				if (0 != traceID)
+				{
+					msg->SetTraceID(traceID);
+					Tracer::Instant(traceID, "recv", sessionID);
+				}
 				break;
 			}
 			case ESocketMessageType::Close:
@@ -50,7 +67,9 @@ namespace moon
 
 		std::shared_ptr<NetWorkFrame>		Net;
 		std::function<void(uint32_t, const std::string&, uint8_t)>OnMessage;
+		std::function<void(uint32_t, const MessagePtr&, uint8_t)>OnBufferMessage;
 		SyncQueue<MessagePtr,1000>			NetMsgQueue;
+		uint32_t										DrainTimeout;
 	};
 
 	Network::Network()
@@ -86,12 +105,25 @@ namespace moon
 		return m_NetworkImp->Net->SyncConnect(ip, port);
 	}
 
-	void Network::Send(SessionID sessionID,const std::string& data)
+	void Network::Send(SessionID sessionID,const std::string& data, uint8_t priority)
 	{
 		Assert(nullptr != m_NetworkImp, "Network::SendNetMessage: Network not init");
 		auto s = ObjectCreateHelper<MemoryStream>::Create(data.size());
 		s->WriteBack(data.data(), 0, data.size());
-		m_NetworkImp->Net->Send(sessionID, s);
+		//正在处理追踪的消息时, Session 在写入 socket 完成后记录 "write"
+		m_NetworkImp->Net->Send(sessionID, s, ESendPriority(priority), Tracer::Current());
+	}
+
+	void Network::SendMessage(SessionID sessionID, const MessagePtr& msg, uint8_t priority)
+	{
+		Assert(nullptr != m_NetworkImp, "Network::SendMessage: Network not init");
+		auto s = msg->GetStream();
+		if (nullptr == s)
+		{
+			s = ObjectCreateHelper<MemoryStream>::Create(msg->Size());
+			s->WriteBack(msg->Data(), 0, msg->Size());
+		}
+		m_NetworkImp->Net->Send(sessionID, s, ESendPriority(priority), Tracer::Current());
 	}
 
 	void Network::Close(SessionID sessionID)
@@ -108,11 +140,82 @@ namespace moon
 		m_NetworkImp->Net->SetTimeout(timeout);
 	}
 
+	void Network::SetDrainTimeout(uint32_t timeout)
+	{
+		Assert(nullptr != m_NetworkImp, "Network::SetDrainTimeout: Network not init");
+
+		m_NetworkImp->DrainTimeout = timeout;
+	}
+
+	void Network::SetAdmission(uint32_t maxSessions, uint32_t connectRate, uint32_t maxBacklog, bool pauseAccept)
+	{
+		Assert(nullptr != m_NetworkImp, "Network::SetAdmission: Network not init");
+
+		AdmissionConfig cfg;
+		cfg.MaxSessions = maxSessions;
+		cfg.MaxConnectRate = connectRate;
+		cfg.MaxBacklog = maxBacklog;
+		cfg.PauseAccept = pauseAccept;
+		m_NetworkImp->Net->SetAdmission(cfg);
+	}
+
+	void Network::SetRateLimit(uint32_t framesPerSecond, uint32_t bytesPerSecond, const std::string& action)
+	{
+		Assert(nullptr != m_NetworkImp, "Network::SetRateLimit: Network not init");
+
+		RateLimitConfig cfg;
+		cfg.FramesPerSecond = framesPerSecond;
+		cfg.BytesPerSecond = bytesPerSecond;
+		if (action == "pause")
+		{
+			cfg.Action = ERateLimitAction::Pause;
+		}
+		else if (action == "drop")
+		{
+			cfg.Action = ERateLimitAction::Drop;
+		}
+		else
+		{
+			Assert(action == "close", "Network::SetRateLimit: action must be pause, drop or close");
+			cfg.Action = ERateLimitAction::Close;
+		}
+		m_NetworkImp->Net->SetRateLimit(cfg);
+	}
+
+	std::string Network::GetAdmissionStats()
+	{
+		Assert(nullptr != m_NetworkImp, "Network::GetAdmissionStats: Network not init");
+
+		auto& net = m_NetworkImp->Net;
+		return string_utils::format("sessions:%llu;rejected:%llu;sessionlimit:%llu;connectrate:%llu;backlog:%llu;paused:%llu;"
+			, (unsigned long long)net->GetSessionCount()
+			, (unsigned long long)net->GetRejectedCount()
+			, (unsigned long long)net->GetRejectedCount(EAdmission::SessionLimit)
+			, (unsigned long long)net->GetRejectedCount(EAdmission::ConnectRate)
+			, (unsigned long long)net->GetRejectedCount(EAdmission::Backlog)
+			, (unsigned long long)net->GetPausedCount());
+	}
+
 	void Network::SetHandler(const std::function<void(uint32_t, const std::string&, uint8_t)>& h)
 	{
 		m_NetworkImp->OnMessage = h;
 	}
 
+	void Network::SetBufferHandler(const std::function<void(uint32_t, const MessagePtr&, uint8_t)>& h)
+	{
+		m_NetworkImp->OnBufferMessage = h;
+	}
+
+	std::function<void(uint32_t, const std::string&, uint8_t)> Network::GetHandler()
+	{
+		return m_NetworkImp->OnMessage;
+	}
+
+	std::function<void(uint32_t, const MessagePtr&, uint8_t)> Network::GetBufferHandler()
+	{
+		return m_NetworkImp->OnBufferMessage;
+	}
+
 	void Network::Start()
 	{
 		if (nullptr == m_NetworkImp)
@@ -126,11 +229,23 @@ namespace moon
 		if (nullptr == m_NetworkImp)
 			return;
 
-		if (m_NetworkImp->OnMessage != nullptr)
+		if (m_NetworkImp->OnBufferMessage != nullptr)
 		{
 			auto msgs = m_NetworkImp->NetMsgQueue.Move();
 			for (auto& it : msgs)
 			{
+				Tracer::Instant(it->GetTraceID(), "dispatch", it->GetSender());
+				Tracer::Scope scope(it->GetTraceID(), "handle", it->GetSender());
+				m_NetworkImp->OnBufferMessage(it->GetSender(), it, (uint8_t)it->GetType());
+			}
+		}
+		else if (m_NetworkImp->OnMessage != nullptr)
+		{
+			auto msgs = m_NetworkImp->NetMsgQueue.Move();
+			for (auto& it : msgs)
+			{
+				Tracer::Instant(it->GetTraceID(), "dispatch", it->GetSender());
+				Tracer::Scope scope(it->GetTraceID(), "handle", it->GetSender());
 				m_NetworkImp->OnMessage(it->GetSender(),it->Bytes(),(uint8_t)it->GetType());
 			}
 		}
@@ -141,8 +256,49 @@ namespace moon
 		if (nullptr == m_NetworkImp)
 			return;
 		m_NetworkImp->NetMsgQueue.Exit();
+
+		if (m_NetworkImp->DrainTimeout > 0)
+		{
+			m_NetworkImp->Net->StopAccept();
+			//通知模块网络即将关闭，模块可以在回掉中发送最后的消息
+			if (m_NetworkImp->OnBufferMessage != nullptr)
+			{
+				auto msg = ObjectCreateHelper<Message>::Create();
+				msg->SetType(EMessageType::NetworkDrain);
+				m_NetworkImp->OnBufferMessage(0, msg, (uint8_t)EMessageType::NetworkDrain);
+			}
+			else if (m_NetworkImp->OnMessage != nullptr)
+			{
+				m_NetworkImp->OnMessage(0, std::string(), (uint8_t)EMessageType::NetworkDrain);
+			}
+
+			//回掉可能引用 Module 的数据, 不能在关闭线程中释放
+			m_NetworkImp->OnMessage = nullptr;
+			m_NetworkImp->OnBufferMessage = nullptr;
+
+			{
+				std::lock_guard<std::mutex> lck(DrainLock);
+				DrainCount++;
+			}
+			auto imp = m_NetworkImp;
+			std::thread([imp]() mutable {
+				imp->Net->Stop(imp->DrainTimeout);
+				imp.reset();
+				std::lock_guard<std::mutex> lck(DrainLock);
+				DrainCount--;
+				DrainCond.notify_all();
+			}).detach();
+			return;
+		}
+
 		m_NetworkImp->Net->Stop();
 	}
 
+	void Network::WaitDrain()
+	{
+		std::unique_lock<std::mutex> lck(DrainLock);
+		DrainCond.wait(lck, []() { return 0 == DrainCount; });
+	}
+
 }
 
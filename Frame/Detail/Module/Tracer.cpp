@@ -0,0 +1,233 @@
+/****************************************************************************
+
+Git <https://github.com/sniper00/MoonNetLua>
+E-Mail <hanyongtao@live.com>
+Copyright (c) 2015-2016 moon
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+
+****************************************************************************/
+
+#include "Tracer.h"
+#include <cstdio>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+namespace moon
+{
+	struct TraceEvent
+	{
+		uint64_t				TraceID;
+		int64_t				Start;
+		//持续时间, 小于 0 表示时间点事件
+		int64_t				Duration;
+		const char*			Name;
+		uint32_t				ID;
+	};
+
+	//环形缓冲区的一个位置。 Seq 为 n+1 时保存第 n 个事件, 0 表示正在写入
+	struct TraceSlot
+	{
+		std::atomic<uint64_t>				Seq{ 0 };
+		std::atomic<uint64_t>				TraceID{ 0 };
+		std::atomic<int64_t>				Start{ 0 };
+		std::atomic<int64_t>				Duration{ 0 };
+		std::atomic<const char*>		Name{ nullptr };
+		std::atomic<uint32_t>				ID{ 0 };
+	};
+
+	//一个线程的环形缓冲区。 只有所属线程写入, 不加锁。
+	//导出时按 Seq 检查, 读取期间被覆盖的事件丢弃(seqlock)
+	struct TraceRing
+	{
+		TraceRing(uint32_t tid)
+			:Tid(tid), Next(0), Slots(Tracer::RING_SIZE)
+		{
+		}
+
+		void Push(const TraceEvent& e)
+		{
+			auto n = Next.load(std::memory_order_relaxed);
+			auto& slot = Slots[n % Slots.size()];
+			slot.Seq.store(0, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			slot.TraceID.store(e.TraceID, std::memory_order_relaxed);
+			slot.Start.store(e.Start, std::memory_order_relaxed);
+			slot.Duration.store(e.Duration, std::memory_order_relaxed);
+			slot.Name.store(e.Name, std::memory_order_relaxed);
+			slot.ID.store(e.ID, std::memory_order_relaxed);
+			slot.Seq.store(n + 1, std::memory_order_release);
+			Next.store(n + 1, std::memory_order_release);
+		}
+
+		//读取第 n 个事件, 已经被覆盖或者正在写入时返回 false
+		bool Read(uint64_t n, TraceEvent& e)
+		{
+			auto& slot = Slots[n % Slots.size()];
+			if (slot.Seq.load(std::memory_order_acquire) != n + 1)
+				return false;
+			e.TraceID = slot.TraceID.load(std::memory_order_relaxed);
+			e.Start = slot.Start.load(std::memory_order_relaxed);
+			e.Duration = slot.Duration.load(std::memory_order_relaxed);
+			e.Name = slot.Name.load(std::memory_order_relaxed);
+			e.ID = slot.ID.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			return slot.Seq.load(std::memory_order_relaxed) == n + 1;
+		}
+
+		uint32_t								Tid;
+		std::atomic<uint64_t>				Next;
+		std::vector<TraceSlot>			Slots;
+	};
+
+	//线程退出后环形缓冲区保留, 之前的事件仍然可以导出
+	struct TraceRegistry
+	{
+		std::mutex								Lock;
+		std::vector<TraceRing*>			All;
+	};
+
+	static TraceRegistry& GetRegistry()
+	{
+		//不析构, 进程退出时其它线程可能还在记录
+		static TraceRegistry* reg = new TraceRegistry();
+		return *reg;
+	}
+
+	static TraceRing* LocalRing()
+	{
+		thread_local TraceRing* ring = nullptr;
+		if (nullptr == ring)
+		{
+			auto& reg = GetRegistry();
+			std::lock_guard<std::mutex> lck(reg.Lock);
+			ring = new TraceRing(static_cast<uint32_t>(reg.All.size() + 1));
+			reg.All.push_back(ring);
+		}
+		return ring;
+	}
+
+	static int64_t NanoSecond()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	static std::atomic<uint32_t> SampleRate(0);
+	static std::atomic<uint64_t> IncreaseTraceID(0);
+	static thread_local uint64_t CurrentTraceID = 0;
+
+	void Tracer::SetSampleRate(uint32_t n)
+	{
+		SampleRate = n;
+	}
+
+	uint32_t Tracer::GetSampleRate()
+	{
+		return SampleRate.load();
+	}
+
+	uint64_t Tracer::Sample()
+	{
+		auto rate = SampleRate.load(std::memory_order_relaxed);
+		if (0 == rate)
+			return 0;
+
+		thread_local uint32_t counter = 0;
+		if (++counter < rate)
+			return 0;
+		counter = 0;
+		return ++IncreaseTraceID;
+	}
+
+	uint64_t Tracer::Current()
+	{
+		return CurrentTraceID;
+	}
+
+	void Tracer::Instant(uint64_t traceID, const char* name, uint32_t id)
+	{
+		if (0 == traceID)
+			return;
+		LocalRing()->Push(TraceEvent{ traceID, NanoSecond(), -1, name, id });
+	}
+
+	Tracer::Scope::Scope(uint64_t traceID, const char* name, uint32_t id)
+		:m_TraceID(traceID), m_Prev(0), m_Name(name), m_ID(id), m_Start(0)
+	{
+		if (0 == m_TraceID)
+			return;
+		m_Prev = CurrentTraceID;
+		CurrentTraceID = m_TraceID;
+		m_Start = NanoSecond();
+	}
+
+	Tracer::Scope::~Scope()
+	{
+		if (0 == m_TraceID)
+			return;
+		CurrentTraceID = m_Prev;
+		LocalRing()->Push(TraceEvent{ m_TraceID, m_Start, NanoSecond() - m_Start, m_Name, m_ID });
+	}
+
+	//Chrome 的时间单位是微秒, 保留到纳秒
+	static std::string Microsecond(int64_t ns)
+	{
+		char buf[32];
+		snprintf(buf, sizeof(buf), "%lld.%03lld", (long long)(ns / 1000), (long long)(ns % 1000));
+		return buf;
+	}
+
+	std::string Tracer::Export(uint32_t pid)
+	{
+		std::vector<TraceRing*> rings;
+		{
+			auto& reg = GetRegistry();
+			std::lock_guard<std::mutex> lck(reg.Lock);
+			rings = reg.All;
+		}
+
+		std::string json = "{\"traceEvents\":[";
+		bool first = true;
+		for (auto ring : rings)
+		{
+			std::vector<TraceEvent> events;
+			auto next = ring->Next.load(std::memory_order_acquire);
+			auto count = std::min<uint64_t>(next, ring->Slots.size());
+			for (uint64_t i = next - count; i < next; i++)
+			{
+				TraceEvent e;
+				if (ring->Read(i, e))
+				{
+					events.push_back(e);
+				}
+			}
+
+			for (auto& e : events)
+			{
+				if (!first)
+				{
+					json += ",";
+				}
+				first = false;
+
+				json += "\n{\"name\":\"";
+				json += e.Name;
+				json += "\",\"cat\":\"message\",\"ph\":\"";
+				json += (e.Duration < 0) ? "i\",\"s\":\"t" : "X";
+				json += "\",\"ts\":" + Microsecond(e.Start);
+				if (e.Duration >= 0)
+				{
+					json += ",\"dur\":" + Microsecond(e.Duration);
+				}
+				json += ",\"pid\":" + std::to_string(pid);
+				json += ",\"tid\":" + std::to_string(ring->Tid);
+				json += ",\"args\":{\"trace\":" + std::to_string(e.TraceID);
+				json += ",\"id\":" + std::to_string(e.ID) + "}}";
+			}
+		}
+		json += "\n]}\n";
+		return json;
+	}
+};
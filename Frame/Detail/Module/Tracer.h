@@ -0,0 +1,83 @@
+/****************************************************************************
+
+Git <https://github.com/sniper00/MoonNetLua>
+E-Mail <hanyongtao@live.com>
+Copyright (c) 2015-2016 moon
+Licensed under the MIT License <http://opensource.org/licenses/MIT>.
+
+****************************************************************************/
+
+#pragma once
+#include <cstdint>
+#include <string>
+
+namespace moon
+{
+	//消息流程追踪。 按采样率选中的网络消息分配一个 TraceID, Module 处理这条消息时发送的消息
+	//继承同一个 TraceID。 经过的各个环节把事件记录到线程本地的环形缓冲区, 可以导出为
+	//Chrome trace event JSON (chrome://tracing 或 Perfetto 打开)。 没有采样的消息只多一次判断
+	class Tracer
+	{
+	public:
+		//每个线程最多保留的事件数, 写满后覆盖最早的事件
+		constexpr static size_t RING_SIZE = 8192;
+
+		/**
+		* 设置采样率, 每个网络线程每 n 条网络消息追踪一条, 0 表示关闭
+		*
+		* @n
+		*/
+		static void			SetSampleRate(uint32_t n);
+
+		static uint32_t		GetSampleRate();
+
+		/**
+		* 采样, 选中时返回新的 TraceID, 否则返回 0
+		*/
+		static uint64_t		Sample();
+
+		/**
+		* 当前线程正在处理的消息的 TraceID, 0 表示没有
+		*/
+		static uint64_t		Current();
+
+		/**
+		* 记录一个时间点事件
+		*
+		* @traceID
+		* @name 事件名, 必须是字符串常量
+		* @id 相关的 ModuleID 或者 SessionID
+		*/
+		static void			Instant(uint64_t traceID, const char* name, uint32_t id);
+
+		/**
+		* 导出所有线程的事件
+		*
+		* @pid 导出的进程号, 一般使用 machine id
+		* @return Chrome trace event JSON
+		*/
+		static std::string	Export(uint32_t pid);
+
+		/**
+		* 处理一条消息的范围: 期间当前线程的 TraceID 是这条消息的 TraceID,
+		* 析构时记录一个持续时间事件。 traceID 为 0 时什么也不做
+		*/
+		class Scope
+		{
+		public:
+			Scope(uint64_t traceID, const char* name, uint32_t id);
+
+			~Scope();
+
+			Scope(const Scope&) = delete;
+
+			Scope& operator=(const Scope&) = delete;
+		private:
+			uint64_t			m_TraceID;
+			uint64_t			m_Prev;
+			const char*		m_Name;
+			uint32_t			m_ID;
+			int64_t			m_Start;
+		};
+	};
+};
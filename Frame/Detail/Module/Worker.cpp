@@ -16,8 +16,29 @@ Licensed under the MIT License <http://opensource.org/licenses/MIT>.
 
 namespace moon
 {
-	Worker::Worker()
+	//工作线程 Update 间隔 ms
+	constexpr uint32_t WORKER_UPDATE_INTERVAL = 20;
+	//迁移过的 Module 在这段时间(ms)内不会再次迁移, 避免来回迁移
+	constexpr int64_t MODULE_MIGRATE_COOLDOWN = 1000;
+	//连续处理消息时, 每处理这么多次检查一次是否需要迁移
+	constexpr uint32_t STEAL_CHECK_TURNS = 32;
+	//每处理这么多次检查一次时间预算
+	constexpr uint32_t TIME_CHECK_TURNS = 16;
+	//每一轮最多直接加入处理队列的次数, 超过之后经过就绪队列, 留到下一轮
+	constexpr uint32_t DIRECT_SCHEDULE_TURNS = 1024;
+
+	//当前线程正在处理消息的 Worker
+	static thread_local Worker* t_HandlingWorker = nullptr;
+
+	Worker::Worker(ModuleManager* mgr)
 		: m_WorkerID(0),
+		m_Manager(mgr),
+		m_Thief(nullptr),
+		m_Runnable(0),
+		m_StealTurns(0),
+		m_DirectTurns(0),
+		m_Dedicated(false),
+		m_UpdateSeq(0),
 		_fps(0),
 		_msg_counter(0),
 		_timer(0)
@@ -34,8 +55,9 @@ namespace moon
 
 	void Worker::Run()
 	{
-		Interval(20);
+		Interval(WORKER_UPDATE_INTERVAL);
 		onUpdate = std::bind(&Worker::Update, this, std::placeholders::_1);
+		onNotify = std::bind(&Worker::OnNotify, this);
 		LoopThread::Run();
 
 		CONSOLE_TRACE("Worker [%d] Run", m_WorkerID);
@@ -43,14 +65,23 @@ namespace moon
 
 	void Worker::Stop()
 	{
+		//没有运行的 Worker 不会处理投递的事件
+		if (!IsRunning())
+			return;
+
 		Post([this]() {
 			for (auto& iter : m_Modules)
 			{
 				iter.second->Destory();
 				CONSOLE_TRACE("Module [%s:%u] Destory", iter.second->GetName().c_str(), iter.second->GetID());
 			}
+			m_Deferred.clear();
 			m_Modules.clear();
+			m_AdoptTime.clear();
+			m_TickModules.clear();
+			m_Updating.clear();
 		});
+		Notify();
 
 		AsyncEvent::exit();
 
@@ -72,41 +103,81 @@ namespace moon
 			CONSOLE_TRACE("Module [%s:%u] Start", module->GetName().c_str(), module->GetID());
 			module->Start();
 			m_Modules.emplace(module->GetID(), module);
+			if (module->IsEnableUpdate())
+			{
+				ScheduleUpdate(module->GetID());
+			}
+			//Init 中发送的 RPC 请求
+			if (0 != module->GetRPCWakeup())
+			{
+				ScheduleRPCTimeout(module->GetID(), module->GetRPCWakeup());
+			}
 		});
+		Notify();
 	}
 
 	void Worker::RemoveModule(ModuleID moduleID)
 	{
 		Post([this, moduleID]() {
 			auto iter = m_Modules.find(moduleID);
-			assert(iter != m_Modules.end());
-			iter->second->Destory();
-			CONSOLE_TRACE("Module [%s:%u] Destory", iter->second->GetName().c_str(), iter->second->GetID());
-			m_Modules.erase(moduleID);	
+			if (iter == m_Modules.end())
+			{
+				//已经迁移到其它 Worker
+				auto module = m_Manager->FindModule(moduleID);
+				if (nullptr != module && module->GetWorker() != this)
+				{
+					module->GetWorker()->RemoveModule(moduleID);
+				}
+				return;
+			}
+			auto module = iter->second;
+			module->Destory();
+			CONSOLE_TRACE("Module [%s:%u] Destory", module->GetName().c_str(), module->GetID());
+			DetachModule(moduleID);
+			m_Manager->EraseModule(moduleID);
+			//专用 Worker 只有一个 Module, 它移除后 Worker 重新参与分配
+			if (IsDedicated() && m_Modules.empty())
+			{
+				m_Manager->CancelPlacement(m_WorkerID, ModuleManager::EPlacement::Dedicated);
+			}
 		});
+		Notify();
 	}
 
-	void Worker::DispatchMessage(const MessagePtr& msg)
+	void Worker::ReloadModule(ModuleID moduleID)
 	{
-		Post([this, msg]() {
-			auto t = m_Modules.find(msg->GetReceiver());
-			if (t != m_Modules.end())
+		Post([this, moduleID]() {
+			auto iter = m_Modules.find(moduleID);
+			if (iter == m_Modules.end())
 			{
-				t->second->PushMessage(msg);
+				//已经迁移到其它 Worker
+				auto module = m_Manager->FindModule(moduleID);
+				if (nullptr != module && module->GetWorker() != this)
+				{
+					module->GetWorker()->ReloadModule(moduleID);
+				}
+				return;
 			}
-		});
-	}
 
-	void Worker::Broadcast(const MessagePtr& msg)
-	{
-		Post([this, msg]() {
-			for (auto& iter : m_Modules)
+			auto& module = iter->second;
+			auto start = std::chrono::steady_clock::now();
+			bool ok = module->Reload();
+			auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+			if (!ok)
 			{
-				if (iter.second->GetID() == msg->GetSender())
-					continue;
-				iter.second->PushMessage(msg);
+				CONSOLE_WARN("Module [%s:%u] reload failed", module->GetName().c_str(), moduleID);
+				return;
 			}
+			m_Manager->m_ReloadCount++;
+			m_Manager->m_LastReloadTime = static_cast<uint64_t>(us);
+			CONSOLE_INFO("Module [%s:%u] reload in %lld us, %u messages queued", module->GetName().c_str(), moduleID, (long long)us, (uint32_t)module->GetMQSize());
 		});
+		Notify();
+	}
+
+	uint32_t Worker::GetLoad()
+	{
+		return static_cast<uint32_t>(m_ReadyQueue.Size()) + m_Runnable.load(std::memory_order_relaxed);
 	}
 
 	int Worker::GetMessageFps()
@@ -114,6 +185,16 @@ namespace moon
 		return _fps.load();
 	}
 
+	void Worker::SetDedicated(bool v)
+	{
+		m_Dedicated = v;
+	}
+
+	bool Worker::IsDedicated()
+	{
+		return m_Dedicated.load();
+	}
+
 	uint8_t Worker::GetID()
 	{
 		return m_WorkerID;
@@ -124,53 +205,407 @@ namespace moon
 		m_WorkerID = id;
 	}
 
-	//Ϣ
+	//消息处理
 	void Worker::Update(uint32_t interval)
 	{
 		_timer += interval;
-		auto t1 = time::millsecond();
-		//1.Ͷݵ첽¼
+		//1.处理投递的异步事件
 		UpdateEvents();
-		auto t2 = time::millsecond();
-		//2.¸Modules
-		for (auto& Iter : m_Modules)
+		//2.更新到期的Modules
+		UpdateModules(interval);
+		//3.RPC 请求超时
+		CheckRPCTimeout();
+		//4.处理消息
+		HandleMessages();
+		//5.空闲时从其它 Worker 迁移 Module
+		TrySteal();
+
+		if (_timer > 3000)
 		{
-			if (Iter.second->IsEnableUpdate())
+			_fps = _msg_counter;
+			_msg_counter = 0;
+			_timer = 0;
+		}
+	}
+
+	void Worker::OnNotify()
+	{
+		UpdateEvents();
+		HandleMessages();
+	}
+
+	void Worker::AdmitReady()
+	{
+		std::vector<ModulePtr> waitStart;
+		auto admit = [this, &waitStart](const ModulePtr& m) {
+			if (m_Modules.find(m->GetID()) != m_Modules.end())
 			{
-				Iter.second->Update(interval);
+				m_HandleQueue.emplace_back(m.get(), 0);
 			}
-			//ModuleϢг 0ѸModule浽Ϣ
-			if (Iter.second->GetMQSize() != 0)
+			//AddModule 投递的 Start 事件还没有执行，下次再处理
+			else if (nullptr != m_Manager->FindModule(m->GetID()))
+			{
+				waitStart.push_back(m);
+			}
+		};
+
+		for (auto& m : m_WaitStart)
+		{
+			admit(m);
+		}
+
+		ModulePtr ready;
+		while (m_ReadyQueue.PopFront(ready))
+		{
+			admit(ready);
+		}
+
+		m_WaitStart.swap(waitStart);
+		m_Runnable.store(static_cast<uint32_t>(m_HandleQueue.size() + m_Deferred.size()), std::memory_order_relaxed);
+	}
+
+	void Worker::HandleMessages()
+	{
+		//上一轮让出的 Module 已经等待了一轮, 先处理。 可能已经被移除
+		for (auto& m : m_Deferred)
+		{
+			if (m_Modules.find(m->GetID()) != m_Modules.end())
 			{
-				m_HandleQueue.push_back(Iter.second.get());
+				m_HandleQueue.emplace_back(m.get(), 0);
 			}
 		}
-		auto t3 = time::millsecond();
-		//3.ѭϢ
+		m_Deferred.clear();
+
+		AdmitReady();
+
+		auto moduleBudget = m_Manager->GetModuleBudget();
+		auto timeBudget = m_Manager->GetTimeBudget();
+		auto start = std::chrono::steady_clock::now();
+		uint32_t turns = 0;
+
+		m_DirectTurns = 0;
+		t_HandlingWorker = this;
+
+		//循环遍历消息处理队列
 		while (m_HandleQueue.size() != 0)
 		{
-			auto module = m_HandleQueue.front();
+			//有空闲的 Worker 请求迁移
+			if (nullptr != m_Thief.load(std::memory_order_relaxed))
+			{
+				auto thief = m_Thief.exchange(nullptr);
+				if (nullptr != thief)
+				{
+					GiveModule(thief);
+				}
+				if (m_HandleQueue.size() == 0)
+					break;
+			}
+
+			auto entry = m_HandleQueue.front();
 			m_HandleQueue.pop_front();
 
 			_msg_counter++;
-			//ModuleϢδModule嵽β
-			if (module->PeekMessage())
+			//如果该Module还有消息未处理，则把这个Module插到队尾, 用完预算的留到下一轮
+			if (entry.first->PeekMessage())
 			{
-				m_HandleQueue.push_back(module);
+				if (++entry.second == moduleBudget)
+				{
+					Defer(entry.first);
+				}
+				else
+				{
+					m_HandleQueue.push_back(entry);
+				}
+			}
+			m_Runnable.store(static_cast<uint32_t>(m_HandleQueue.size() + m_Deferred.size()), std::memory_order_relaxed);
+
+			if (0 != timeBudget && ++turns % TIME_CHECK_TURNS == 0
+				&& std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(timeBudget))
+			{
+				for (auto& it : m_HandleQueue)
+				{
+					Defer(it.first);
+				}
+				m_HandleQueue.clear();
+				break;
+			}
+
+			//一直有消息处理时也要检查, 否则负载不均的 Worker 永远不会进入空闲状态
+			if (++m_StealTurns == STEAL_CHECK_TURNS)
+			{
+				m_StealTurns = 0;
+				TrySteal();
 			}
 		}
-		auto t4 = time::millsecond();
 
+		t_HandlingWorker = nullptr;
 		assert(m_HandleQueue.size() == 0);
 
-		if (_timer > 3000)
+		//让出之后立即开始下一轮, 中间处理到期的定时器和 Update
+		if (!m_Deferred.empty())
 		{
-			_fps = _msg_counter;
-			_msg_counter = 0;
-			_timer = 0;
+			m_Manager->m_YieldCount++;
+			Notify();
+		}
+	}
+
+	void Worker::Defer(Module* m)
+	{
+		auto iter = m_Modules.find(m->GetID());
+		assert(iter != m_Modules.end());
+		m_Deferred.push_back(iter->second);
+	}
+
+	void Worker::TrySteal()
+	{
+		auto threshold = m_Manager->GetMigrateThreshold();
+		if (0 == threshold || IsDedicated())
+			return;
+
+		//只从比自己至少多两个等待处理的 Module 的 Worker 迁移, 迁移之后不会反过来
+		Worker* victim = nullptr;
+		uint32_t maxLoad = GetLoad() + 1;
+		for (auto& w : m_Manager->m_Workers)
+		{
+			//专用 Worker 上的 Module 都不能迁移
+			if (w.get() == this || w->IsDedicated())
+				continue;
+			auto load = w->GetLoad();
+			if (load >= threshold && load > maxLoad)
+			{
+				victim = w.get();
+				maxLoad = load;
+			}
+		}
+
+		if (nullptr == victim)
+			return;
+
+		Worker* expected = nullptr;
+		if (victim->m_Thief.compare_exchange_strong(expected, this))
+		{
+			victim->Notify();
+		}
+	}
+
+	void Worker::GiveModule(Worker* thief)
+	{
+		auto threshold = m_Manager->GetMigrateThreshold();
+		AdmitReady();
+		if (0 == threshold || m_HandleQueue.size() < threshold)
+			return;
+
+		//请求迁移之后 thief 可能被预留为专用 Worker
+		std::lock_guard<std::mutex> lck(m_Manager->m_PlacementLock);
+		if (thief->IsDedicated())
+			return;
+
+		auto now = time::millsecond();
+		//从队尾开始选择, 队尾的 Module 等待的时间最长
+		for (auto it = m_HandleQueue.rbegin(); it != m_HandleQueue.rend(); ++it)
+		{
+			auto id = it->first->GetID();
+			auto adopt = m_AdoptTime.find(id);
+			if (adopt != m_AdoptTime.end() && now - adopt->second < MODULE_MIGRATE_COOLDOWN)
+				continue;
+
+			if (it->first->IsPinned())
+				continue;
+
+			auto iter = m_Modules.find(id);
+			assert(iter != m_Modules.end());
+			auto module = iter->second;
+
+			m_HandleQueue.erase(std::next(it).base());
+			m_Runnable.store(static_cast<uint32_t>(m_HandleQueue.size() + m_Deferred.size()), std::memory_order_relaxed);
+			DetachModule(id);
+
+			//Module 仍然是就绪状态, 发送者在 PushMessage 之后会读取新的 Worker
+			module->SetWorker(thief);
+			thief->AdoptModule(module);
+			m_Manager->m_MigrateCount++;
+			CONSOLE_TRACE("Module [%s:%u] migrate from Worker [%d] to Worker [%d]", module->GetName().c_str(), id, m_WorkerID, thief->GetID());
+			return;
+		}
+	}
+
+	void Worker::AdoptModule(const ModulePtr & module)
+	{
+		Post([this, module]() {
+			m_Modules.emplace(module->GetID(), module);
+			m_AdoptTime[module->GetID()] = time::millsecond();
+			if (module->IsEnableUpdate())
+			{
+				ScheduleUpdate(module->GetID());
+			}
+			//原来的 Worker 中的到期时间已经失效
+			if (0 != module->GetRPCWakeup())
+			{
+				ScheduleRPCTimeout(module->GetID(), module->GetRPCWakeup());
+			}
+			m_ReadyQueue.PushBack(module);
+		});
+		Notify();
+	}
+
+	void Worker::DetachModule(ModuleID id)
+	{
+		m_Modules.erase(id);
+		m_AdoptTime.erase(id);
+		//m_UpdateQueue 中的项通过 Seq 失效
+		if (m_Updating.erase(id) != 0)
+		{
+			auto it = std::find_if(m_TickModules.begin(), m_TickModules.end(), [id](const ModulePtr& m) {return m->GetID() == id; });
+			if (it != m_TickModules.end())
+			{
+				*it = std::move(m_TickModules.back());
+				m_TickModules.pop_back();
+			}
+		}
+	}
+
+	void Worker::ScheduleUpdate(ModuleID id)
+	{
+		auto iter = m_Modules.find(id);
+		//还没有 Start, Start 之后会检测 IsEnableUpdate
+		if (iter == m_Modules.end())
+			return;
+
+		auto res = m_Updating.emplace(id, 0);
+		if (!res.second)
+			return;
+
+		auto& module = iter->second;
+		if (module->GetUpdateInterval() <= WORKER_UPDATE_INTERVAL)
+		{
+			m_TickModules.push_back(module);
+		}
+		else
+		{
+			auto now = time::millsecond();
+			res.first->second = ++m_UpdateSeq;
+			m_UpdateQueue.push(UpdateEntry{ now + module->GetUpdateInterval(), now, id, m_UpdateSeq });
+		}
+	}
+
+	void Worker::UpdateModules(uint32_t interval)
+	{
+		auto now = time::millsecond();
+
+		for (size_t i = 0; i < m_TickModules.size();)
+		{
+			auto module = m_TickModules[i].get();
+			bool enable = module->IsEnableUpdate();
+			if (enable && module->GetUpdateInterval() <= WORKER_UPDATE_INTERVAL)
+			{
+				module->RunUpdate(interval);
+				++i;
+				continue;
+			}
 
-			//CONSOLE_TRACE("Message fps [%d] , event [%lld ms], copy[%lld ms], work[%lld ms]",_fps.load(), t2 - t1, t3 - t2, t4 - t3);
+			if (enable)
+			{
+				//改成了更长的间隔
+				m_Updating[module->GetID()] = ++m_UpdateSeq;
+				m_UpdateQueue.push(UpdateEntry{ now + module->GetUpdateInterval(), now, module->GetID(), m_UpdateSeq });
+			}
+			else
+			{
+				m_Updating.erase(module->GetID());
+			}
+			m_TickModules[i] = std::move(m_TickModules.back());
+			m_TickModules.pop_back();
 		}
+
+		//Worker 的 Update 间隔有误差，提前半个间隔到期的也在这一次执行
+		auto due = now + WORKER_UPDATE_INTERVAL / 2;
+		while (!m_UpdateQueue.empty() && m_UpdateQueue.top().Deadline <= due)
+		{
+			auto entry = m_UpdateQueue.top();
+			m_UpdateQueue.pop();
+
+			auto updating = m_Updating.find(entry.ID);
+			if (updating == m_Updating.end() || updating->second != entry.Seq)
+				continue;
+
+			auto iter = m_Modules.find(entry.ID);
+			if (iter == m_Modules.end() || !iter->second->IsEnableUpdate())
+			{
+				//已经移除或者关闭了 Update
+				m_Updating.erase(entry.ID);
+				continue;
+			}
+
+			auto& module = iter->second;
+			module->RunUpdate(static_cast<uint32_t>(now - entry.Prev));
+			entry.Prev = now;
+
+			if (!module->IsEnableUpdate())
+			{
+				m_Updating.erase(entry.ID);
+				continue;
+			}
+
+			if (module->GetUpdateInterval() <= WORKER_UPDATE_INTERVAL)
+			{
+				m_Updating[entry.ID] = 0;
+				m_TickModules.push_back(module);
+				continue;
+			}
+
+			//按固定间隔对齐，落后太多时不再追赶
+			entry.Deadline += module->GetUpdateInterval();
+			if (entry.Deadline <= now)
+			{
+				entry.Deadline = now + module->GetUpdateInterval();
+			}
+			m_UpdateQueue.push(entry);
+		}
+	}
+
+	void Worker::ScheduleRPCTimeout(ModuleID id, int64_t deadline)
+	{
+		m_RPCTimeouts.emplace(deadline, id);
+	}
+
+	void Worker::CheckRPCTimeout()
+	{
+		auto now = time::millsecond();
+		while (!m_RPCTimeouts.empty() && m_RPCTimeouts.top().first <= now)
+		{
+			auto entry = m_RPCTimeouts.top();
+			m_RPCTimeouts.pop();
+
+			//已经移除或者迁移到其它 Worker
+			auto iter = m_Modules.find(entry.second);
+			if (iter == m_Modules.end())
+				continue;
+
+			auto next = iter->second->CheckRPCTimeout(entry.first, now);
+			if (0 != next)
+			{
+				m_RPCTimeouts.emplace(next, entry.second);
+			}
+		}
+	}
+
+	void Worker::Schedule(const ModulePtr & m)
+	{
+		//在这个 Worker 处理消息时发给同一个 Worker 上的 Module, 直接加入处理队列, 在这一轮中处理
+		if (t_HandlingWorker == this && m_DirectTurns < DIRECT_SCHEDULE_TURNS)
+		{
+			auto iter = m_Modules.find(m->GetID());
+			if (iter != m_Modules.end())
+			{
+				m_DirectTurns++;
+				m_HandleQueue.emplace_back(iter->second.get(), 0);
+				m_Runnable.store(static_cast<uint32_t>(m_HandleQueue.size() + m_Deferred.size()), std::memory_order_relaxed);
+				return;
+			}
+		}
+
+		m_ReadyQueue.PushBack(m);
+		Notify();
 	}
 };
 
@@ -12,67 +12,187 @@ Licensed under the MIT License <http://opensource.org/licenses/MIT>.
 #include "Common/LoopThread.hpp"
 #include "Common/AsyncEvent.hpp"
 #include "Common/noncopyable.hpp"
+#include "Common/MpscQueue.hpp"
+#include <queue>
 
 namespace moon
 {
 	class Message;
+	class ModuleManager;
 
 	DECLARE_SHARED_PTR(Module)
 	DECLARE_SHARED_PTR(Message)
-	//߳
+	//工作线程
 	class Worker:public LoopThread,public AsyncEvent, noncopyable
 	{
 	public:
-		Worker();
+		Worker(ModuleManager* mgr);
 
 		~Worker();
 
 		/**
-		* ߳
+		* 启动工作线程
 		*
 		*/
 		void Run();
 
 		/**
-		* ֹͣ߳
+		* 停止工作线程
 		*
 		*/
 		void Stop();
 
 		/**
-		* ߳Module
+		* 向工作线程添加Module
 		*
 		*/
 		void AddModule(const ModulePtr& m);
 
 		/**
-		* ƳModule
+		* 移除Module
 		*
 		*/
 		void RemoveModule(ModuleID id);
 
 		/**
-		* Ϣַ
+		* 重新加载Module, 见 Module::Reload
+		*
+		*/
+		void ReloadModule(ModuleID id);
+
+		/**
+		* 把 Module 放入就绪队列, PushMessage 返回 true 时调用。 这个函数是线程安全的。
+		* 在这个 Worker 的线程中处理消息时调用, 直接加入处理队列, 不需要唤醒, 在这一轮中处理
 		*/
-		void DispatchMessage(const MessagePtr& msg);
+		void			Schedule(const ModulePtr& m);
 
 		/**
-		* WorkerеModule㲥Ϣ
+		* 等待处理的 Module 数目(近似值), 用于判断是否需要迁移。 这个函数是线程安全的
 		*/
-		void Broadcast(const MessagePtr& msg);
+		uint32_t		GetLoad();
 
 		int	GetMessageFps();
 
 		uint8_t		GetID();
 
 		void			SetID(uint8_t id);
+
+		/**
+		* 专用的 Worker 只运行放置在它上面的 Module, 不参与轮询分配, 也不从其它 Worker 迁移 Module。
+		* 这个函数是线程安全的
+		*/
+		void			SetDedicated(bool v);
+
+		bool			IsDedicated();
+
+		/**
+		* 把 Module 加入 Update 定时队列，只能在工作线程中调用
+		*/
+		void			ScheduleUpdate(ModuleID id);
+
+		/**
+		* 在 deadline(ms) 调用 Module 的 CheckRPCTimeout, 只能在工作线程中调用
+		*/
+		void			ScheduleRPCTimeout(ModuleID id, int64_t deadline);
 	private:
 		void			Update(uint32_t interval);
+
+		/**
+		* 被 Notify 唤醒时处理投递的事件和消息
+		*/
+		void			OnNotify();
+
+		/**
+		* 处理就绪队列中Module的消息, 预算用完时让出, 见 ModuleManager::SetTurnBudget
+		*/
+		void			HandleMessages();
+
+		/**
+		* 把处理队列中剩下的 Module 留到下一轮
+		*/
+		void			Defer(Module* m);
+
+		/**
+		* 把就绪队列中的 Module 放入处理队列
+		*/
+		void			AdmitReady();
+
+		/**
+		* 向最忙的 Worker 请求迁移一个 Module
+		*/
+		void			TrySteal();
+
+		/**
+		* 把处理队列中的一个 Module 迁移到 thief, 在两个 Module 的消息处理之间调用
+		*/
+		void			GiveModule(Worker* thief);
+
+		/**
+		* 接收其它 Worker 迁移过来的 Module, 这个 Module 已经在就绪状态
+		*/
+		void			AdoptModule(const ModulePtr& m);
+
+		/**
+		* 从这个 Worker 的调度数据中移除 Module
+		*/
+		void			DetachModule(ModuleID id);
+
+		/**
+		* 调用到期 Module 的 Update
+		*/
+		void			UpdateModules(uint32_t interval);
+
+		/**
+		* 调用 RPC 请求到期的 Module 的 CheckRPCTimeout
+		*/
+		void			CheckRPCTimeout();
+
+		struct UpdateEntry
+		{
+			int64_t		Deadline;
+			//上次 Update 的时间
+			int64_t		Prev;
+			ModuleID	ID;
+			//和 m_Updating 中的值不同时说明这一项已经失效
+			uint32_t		Seq;
+
+			bool operator>(const UpdateEntry& other) const
+			{
+				return Deadline > other.Deadline;
+			}
+		};
 	private:
 		uint8_t																			m_WorkerID;
+		ModuleManager*															m_Manager;
+		//已经 Start 的 Module, 只在工作线程中访问
 		std::unordered_map<ModuleID, ModulePtr>				m_Modules;
-		//ģ鴦
-		std::deque<Module*>													m_HandleQueue;
+		//迁移过来的 Module 和迁移的时间
+		std::unordered_map<ModuleID, int64_t>					m_AdoptTime;
+		//请求从这个 Worker 迁移 Module 的空闲 Worker
+		std::atomic<Worker*>													m_Thief;
+		//处理队列中的 Module 数目
+		std::atomic<uint32_t>													m_Runnable;
+		uint32_t																		m_StealTurns;
+		//这一轮直接加入处理队列的次数, 见 Schedule
+		uint32_t																		m_DirectTurns;
+		std::atomic_bool																m_Dedicated;
+		//有未处理消息的 Module
+		MpscQueue<ModulePtr>												m_ReadyQueue;
+		//收到消息时还没有 Start 的 Module
+		std::vector<ModulePtr>												m_WaitStart;
+		//模块处理队列, 和这一轮已经处理的次数
+		std::deque<std::pair<Module*, uint32_t>>						m_HandleQueue;
+		//用完了这一轮预算的 Module, 下一轮最先处理
+		std::vector<ModulePtr>												m_Deferred;
+		//每次 Worker Update 都需要 Update 的 Module
+		std::vector<ModulePtr>												m_TickModules;
+		//设置了更长 Update 间隔的 Module, 按到期时间排序
+		std::priority_queue<UpdateEntry, std::vector<UpdateEntry>, std::greater<UpdateEntry>>	m_UpdateQueue;
+		//在 m_TickModules(值为0) 或者 m_UpdateQueue 中的 Module
+		std::unordered_map<ModuleID, uint32_t>					m_Updating;
+		uint32_t																		m_UpdateSeq;
+		//(到期时间, ModuleID), 见 Module::SendRPC
+		std::priority_queue<std::pair<int64_t, ModuleID>, std::vector<std::pair<int64_t, ModuleID>>, std::greater<std::pair<int64_t, ModuleID>>>	m_RPCTimeouts;
 
 		std::atomic<int>															_fps;
 		uint32_t																		_msg_counter;
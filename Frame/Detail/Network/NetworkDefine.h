@@ -17,11 +17,12 @@ namespace moon
 	enum  class ESocketState
 	{
 		Ok,											//ok
-		GetRemoteEndPointFailed,		//ȡԶӶ˿Ϣʧ
-		Timeout,									//ʱ
-		ClientClose,								//ͻ˳
-		IllegalDataLength,					//Ƿݳ
-		ForceClose								//ǿƹر
+		GetRemoteEndPointFailed,		//获取远程连接端口信息失败
+		Timeout,									//超时
+		ClientClose,								//客户端退出
+		IllegalDataLength,					//非法数据长度
+		ForceClose,								//强制关闭
+		RateLimited								//接收数据超过频率限制
 	};
 
 	enum class ESocketMessageType
@@ -31,12 +32,64 @@ namespace moon
 		RecvData
 	};
 
+	//发送优先级
+	enum class ESendPriority :uint8_t
+	{
+		Urgent,									//紧急消息，在消息边界插队到大数据之前发送
+		Bulk										//大数据，分片发送，不会长时间占用连接
+	};
+
+	//连接准入检测结果
+	enum class EAdmission :uint8_t
+	{
+		Accept,									//允许连接
+		SessionLimit,							//连接数超过上限
+		ConnectRate,							//单个IP连接频率超过上限
+		Backlog,									//未处理的网络消息积压超过上限
+		Max
+	};
+
+	//连接准入控制配置, 各项为0表示不限制
+	struct AdmissionConfig
+	{
+		//最大连接数
+		uint32_t		MaxSessions = 0;
+		//单个IP每秒最多建立的连接数
+		uint32_t		MaxConnectRate = 0;
+		//未处理的网络消息数上限
+		uint32_t		MaxBacklog = 0;
+		//true: 超过连接数或积压上限时暂停accept, 新连接留在系统的监听队列中
+		//false: accept 后发送拒绝数据包(见 ADMISSION_REJECT_MSGID)再关闭
+		bool			PauseAccept = false;
+	};
+
+	//单个连接接收数据超过频率限制时的处理方式
+	enum class ERateLimitAction
+	{
+		Pause,									//暂停读取，直到令牌足够
+		Drop,										//丢弃超出的消息
+		Close									//关闭连接 ESocketState::RateLimited
+	};
+
+	//单个连接的接收频率限制(令牌桶), 各项为0表示不限制
+	struct RateLimitConfig
+	{
+		//每秒最多接收的消息数
+		uint32_t				FramesPerSecond = 0;
+		//每秒最多接收的字节数
+		uint32_t				BytesPerSecond = 0;
+		ERateLimitAction	Action = ERateLimitAction::Close;
+	};
+
 	DECLARE_SHARED_PTR(MemoryStream)
 
 	using NetMessageDelegate = std::function<void(ESocketMessageType, SessionID, const MemoryStreamPtr&)>;
 
 	typedef uint16_t msg_size_t;
-	//Ϣ
+	//最大消息长度
 #define MAX_MSG_SIZE msg_size_t(-1)
+
+	//拒绝连接时发送的数据包: 长度(2) msgID(2) EAdmission(1) 原因文字, msgID 固定为这个值
+	constexpr uint16_t ADMISSION_REJECT_MSGID = 0xFFFF;
 }
 
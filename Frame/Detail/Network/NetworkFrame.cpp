@@ -24,27 +24,81 @@ namespace moon
 		Imp(uint8_t n)
 			:servicepool(n),
 			acceptor(servicepool.PollAService().GetIoService()),
+			acceptTimer(acceptor.get_io_service()),
 			signals(servicepool.PollAService().GetIoService()),
 			threadNum(n),
-			bOpen(false)
+			bOpen(false),
+			connectWindow(0),
+			pausedCount(0)
 		{
-
+			for (auto& c : rejectedCount)
+			{
+				c = 0;
+			}
 		}
 
 		NetworkServicePool													servicepool;
 		asio::ip::tcp::acceptor													acceptor;
+		//过载时延迟accept
+		asio::steady_timer															acceptTimer;
 		asio::signal_set																signals;
 		asio::error_code															errorCode;
-		//ַ
+		//监听地址
 		std::string																		listenAddress;
-		//˿
+		//监听端口
 		std::string																		listenPort;
-		//߳
+		//网络线程数
 		uint8_t																			threadNum;
 
 		bool																				bOpen;
+
+		AdmissionConfig															admission;
+		std::function<size_t()>													backlogProbe;
+		//当前统计的秒数, 和这一秒内每个IP的连接次数
+		int64_t																			connectWindow;
+		std::unordered_map<std::string, uint32_t>						connectCount;
+
+		std::array<std::atomic<uint64_t>, (size_t)EAdmission::Max>	rejectedCount;
+		std::atomic<uint64_t>														pausedCount;
 	};
 
+	//过载暂停accept后，重新检测的间隔
+	constexpr int ACCEPT_PAUSE_INTERVAL = 100;
+
+	static const char* AdmissionReason(EAdmission v)
+	{
+		switch (v)
+		{
+		case EAdmission::SessionLimit:
+			return "session limit";
+		case EAdmission::ConnectRate:
+			return "connect rate";
+		case EAdmission::Backlog:
+			return "backlog";
+		default:
+			return "ok";
+		}
+	}
+
+	//发送拒绝数据包后关闭连接
+	static void Reject(const SessionPtr& session, EAdmission reason)
+	{
+		auto text = AdmissionReason(reason);
+		auto frame = std::make_shared<std::string>();
+		msg_size_t len = static_cast<msg_size_t>(sizeof(uint16_t) + sizeof(uint8_t) + strlen(text));
+		frame->append((const char*)&len, sizeof(len));
+		frame->append((const char*)&ADMISSION_REJECT_MSGID, sizeof(ADMISSION_REJECT_MSGID));
+		frame->push_back((char)reason);
+		frame->append(text);
+
+		//写完或者失败后关闭, 不等待对方读取
+		asio::async_write(session->GetSocket(), asio::buffer(*frame), [session, frame](const asio::error_code&, std::size_t) {
+			asio::error_code ec;
+			session->GetSocket().shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+			session->GetSocket().close(ec);
+		});
+	}
+
 	NetWorkFrame::NetWorkFrame(const NetMessageDelegate& netMessageDelegate, uint8_t threadNum)
 		:m_Imp(std::make_shared<Imp>(threadNum)), m_Delegate(netMessageDelegate)
 	{
@@ -113,6 +167,24 @@ namespace moon
 			return;
 		}
 
+		//过载时不再accept, 新连接留在监听队列中, 等待负载降低
+		if (m_Imp->admission.PauseAccept)
+		{
+			auto ret = CheckAdmission(std::string());
+			if (ret != EAdmission::Accept)
+			{
+				m_Imp->pausedCount++;
+				m_Imp->acceptTimer.expires_from_now(std::chrono::milliseconds(ACCEPT_PAUSE_INTERVAL));
+				m_Imp->acceptTimer.async_wait([this](const asio::error_code& e) {
+					if (!e)
+					{
+						PostAccept();
+					}
+				});
+				return;
+			}
+		}
+
 		auto& ser = m_Imp->servicepool.PollAService();
 
 		SessionPtr session =  ObjectCreateHelper<Session>::Create(m_Delegate, ser);
@@ -120,7 +192,20 @@ namespace moon
 		m_Imp->acceptor.async_accept(session->GetSocket(), [session, this, &ser](const asio::error_code& e) {
 			if (!e)
 			{
-				ser.AddSession(session);
+				asio::error_code ec;
+				auto endpoint = session->GetSocket().remote_endpoint(ec);
+				auto ip = ec ? std::string() : endpoint.address().to_string();
+				auto ret = CheckAdmission(ip);
+				if (ret == EAdmission::Accept)
+				{
+					ser.AddSession(session);
+				}
+				else
+				{
+					m_Imp->rejectedCount[(size_t)ret]++;
+					LOG_TRACE("NetWorkFrame reject connection %s: %s", ip.c_str(), AdmissionReason(ret));
+					Reject(session, ret);
+				}
 				PostAccept();
 				return;
 			}
@@ -128,6 +213,38 @@ namespace moon
 		});
 	}
 
+	EAdmission NetWorkFrame::CheckAdmission(const std::string& ip)
+	{
+		auto& cfg = m_Imp->admission;
+
+		if (cfg.MaxSessions != 0 && GetSessionCount() >= cfg.MaxSessions)
+		{
+			return EAdmission::SessionLimit;
+		}
+
+		if (cfg.MaxBacklog != 0 && nullptr != m_Imp->backlogProbe && m_Imp->backlogProbe() >= cfg.MaxBacklog)
+		{
+			return EAdmission::Backlog;
+		}
+
+		if (cfg.MaxConnectRate != 0 && !ip.empty())
+		{
+			auto now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+			if (now != m_Imp->connectWindow)
+			{
+				m_Imp->connectWindow = now;
+				m_Imp->connectCount.clear();
+			}
+
+			if (++m_Imp->connectCount[ip] > cfg.MaxConnectRate)
+			{
+				return EAdmission::ConnectRate;
+			}
+		}
+
+		return EAdmission::Accept;
+	}
+
 	void NetWorkFrame::AsyncConnect(const std::string & ip, const std::string & port)
 	{
 		asio::ip::tcp::resolver resolver(m_Imp->servicepool.PollAService().GetIoService());
@@ -184,9 +301,9 @@ namespace moon
 		return session->GetID();
 	}
 
-	void NetWorkFrame::Send(SessionID sessionID, const MemoryStreamPtr& msg)
+	void NetWorkFrame::Send(SessionID sessionID, const MemoryStreamPtr& msg, ESendPriority priority, uint64_t traceID)
 	{
-		m_Imp->servicepool.Send(sessionID, msg);
+		m_Imp->servicepool.Send(sessionID, msg, priority, traceID);
 	}
 
 	void moon::NetWorkFrame::CloseSession(SessionID sessionID, ESocketState state)
@@ -194,6 +311,11 @@ namespace moon
 		m_Imp->servicepool.CloseSession(sessionID, state);
 	}
 
+	void NetWorkFrame::Post(SessionID sessionID, const std::function<void()>& handler)
+	{
+		m_Imp->servicepool.Post(sessionID, handler);
+	}
+
 	void NetWorkFrame::Run()
 	{
 		if (m_Imp->bOpen)
@@ -214,19 +336,27 @@ namespace moon
 		m_Imp->bOpen = true;
 	}
 
-	void NetWorkFrame::Stop()
+	void NetWorkFrame::StopAccept()
 	{
-		if (!m_Imp->bOpen)
+		if (m_Imp->acceptor.is_open())
 		{
-			return;
+			m_Imp->acceptor.close(m_Imp->errorCode);
 		}
 
-		if (m_Imp->acceptor.is_open())
+		asio::error_code ec;
+		m_Imp->acceptTimer.cancel(ec);
+	}
+
+	void NetWorkFrame::Stop(uint32_t drainTimeout)
+	{
+		if (!m_Imp->bOpen)
 		{
-			m_Imp->acceptor.close(m_Imp->errorCode);
+			return;
 		}
 
-		m_Imp->servicepool.Stop();
+		StopAccept();
+
+		m_Imp->servicepool.Stop(drainTimeout);
 		m_Imp->bOpen = false;
 
 		LOG_TRACE("NetWorkFrame stop:%s", m_Imp->errorCode?m_Imp->errorCode.message().c_str():"OK");
@@ -250,6 +380,56 @@ namespace moon
 			iter->second->SetTimeout(timeout);
 		}
 	}
+
+	void NetWorkFrame::SetAdmission(const AdmissionConfig & cfg)
+	{
+		m_Imp->admission = cfg;
+	}
+
+	void NetWorkFrame::SetRateLimit(const RateLimitConfig& cfg)
+	{
+		auto& servs = m_Imp->servicepool.GetServices();
+		for (auto iter = servs.begin(); iter != servs.end(); iter++)
+		{
+			iter->second->SetRateLimit(cfg);
+		}
+	}
+
+	void NetWorkFrame::SetBacklogProbe(const std::function<size_t()>& probe)
+	{
+		m_Imp->backlogProbe = probe;
+	}
+
+	size_t NetWorkFrame::GetSessionCount()
+	{
+		size_t n = 0;
+		auto& servs = m_Imp->servicepool.GetServices();
+		for (auto iter = servs.begin(); iter != servs.end(); iter++)
+		{
+			n += iter->second->GetSessionCount();
+		}
+		return n;
+	}
+
+	uint64_t NetWorkFrame::GetRejectedCount(EAdmission reason)
+	{
+		if (reason != EAdmission::Accept)
+		{
+			return m_Imp->rejectedCount[(size_t)reason].load();
+		}
+
+		uint64_t n = 0;
+		for (auto& c : m_Imp->rejectedCount)
+		{
+			n += c.load();
+		}
+		return n;
+	}
+
+	uint64_t NetWorkFrame::GetPausedCount()
+	{
+		return m_Imp->pausedCount.load();
+	}
 }
 
 
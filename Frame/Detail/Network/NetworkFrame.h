@@ -12,87 +12,143 @@ Licensed under the MIT License <http://opensource.org/licenses/MIT>.
 namespace moon
 {
 	/**
-	* NetWorkFrame ʵӿڡ NetWorkFrame Ƿ̰߳ȫġ
+	* NetWorkFrame 实现了网络库操作接口。 NetWorkFrame 对象本身是非线程安全的。
 	*/
 	class NetWorkFrame
 	{
 	public:
 
 		/**
-		* NetWorkFrame 캯
-		* @handler ¼صconnect, recevie, close)
-		* @threadNum ߳
-		* ע⣺˶̣߳ôhandler صǷ̰߳ȫġ
+		* NetWorkFrame 构造函数
+		* @handler 网络事件回掉（connect, recevie, close)
+		* @threadNum 网络线程数量
+		* 注意：如果开启了多个网络线程，那么handler 回掉函数是非线程安全的。
 		*/
 		NetWorkFrame(const NetMessageDelegate& handler, uint8_t threadNum = 1);
 		~NetWorkFrame();
 
 		/**
-		* ĳ˿
-		* @listenAddress ipַ
-		* @listenPort ˿
+		* 监听某个端口
+		* @listenAddress ip地址或者域名
+		* @listenPort 端口
 		*/
 		void							Listen(const std::string& ip, const std::string& port);
 
 		/**
-		* 첽ĳ˿
-		* @ip ipַ
-		* @port ˿
+		* 异步连接某个端口
+		* @ip ip地址或者域名
+		* @port 端口
 		*/
 		void							AsyncConnect(const std::string& ip, const std::string& port);
 
 		/**
-		* ͬĳ˿
-		* @ip ipַ
-		* @port ˿
-		* @return ӵ socketID, ɹ socketID.value != 0, ʧsocketID.value = 0
+		* 同步连接某个端口
+		* @ip ip地址或者域名
+		* @port 端口
+		* @return 返回链接的 socketID, 成功 socketID.value != 0, 失败socketID.value = 0
 		*/
 		SessionID					SyncConnect(const std::string& ip, const std::string& port);
 
 		/**
-		* ĳӷ, ̰߳ȫ
-		* @sessionID ӱʶ
-		* @data 
+		* 向某个链接发送数据, 这个函数是线程安全的
+		* @sessionID 连接标识
+		* @data 数据
+		* @priority 发送优先级, ESendPriority::Bulk 的数据分片发送，不会阻塞 ESendPriority::Urgent 的数据
+		* @traceID 不为 0 时, 数据写入 socket 完成后记录追踪事件 "write"
 		*/
-		void							Send(SessionID sessionID, const MemoryStreamPtr& msg);
+		void							Send(SessionID sessionID, const MemoryStreamPtr& msg, ESendPriority priority = ESendPriority::Urgent, uint64_t traceID = 0);
 
 		/**
-		* رһ
-		* @sessionID ӱʶ
-		* @state һ״̬Ϊʲôرգ ʱͷǷݣ
+		* 关闭一个链接
+		* @sessionID 连接标识
+		* @state 给链接设置一个状态，表明为什么关闭（例如 超时，发送非法数据）
 		*/
 		void							CloseSession(SessionID sessionID, ESocketState state);
 
 		/**
-		*  ̣߳߳
+		* 在某个链接所属的网络线程中执行 handler, 这个函数是线程安全的
+		* @sessionID 连接标识
+		* @handler
+		*/
+		void							Post(SessionID sessionID, const std::function<void()>& handler);
+
+		/**
+		* 启动网络库 网络库运行在子线程，不会阻塞主线程
 		*/
 		void							Run();
 
 		/**
-		* ֹͣ
+		* 停止接受新的连接
 		*/
-		void							Stop();
+		void							StopAccept();
 
 		/**
-		* ȡ
+		* 停止网络库
+		* @drainTimeout 大于0时为优雅关闭：停止接受新连接，发送完所有连接的发送队列，
+		* 关闭写端并等待对端关闭连接，最多等待 drainTimeout 毫秒后强制关闭
+		*/
+		void							Stop(uint32_t drainTimeout = 0);
+
+		/**
+		* 获取错误码
 		*/
 		int							GetErrorCode();
 
 		/**
-		* ȡϢ
+		* 获取错误信息
 		*/
 		std::string					GetErrorMessage();
 
 		/**
-		* Sessionĳʱ
-		* @timeout ʱʱ λ s
+		* 设置Session的超时检测
+		* @timeout 超时时间 ，单位 s
 		*/
 		void							SetTimeout(uint32_t timeout);
+
+		/**
+		* 设置连接准入控制, 过载时暂停accept或者拒绝新的连接
+		* @cfg
+		*/
+		void							SetAdmission(const AdmissionConfig& cfg);
+
+		/**
+		* 设置每个连接的接收频率限制, 在网络线程中创建消息之前检测
+		* @cfg
+		*/
+		void							SetRateLimit(const RateLimitConfig& cfg);
+
+		/**
+		* 设置获取未处理网络消息数量的回掉, 用于 AdmissionConfig::MaxBacklog 检测
+		* @probe 这个回掉在网络线程中调用
+		*/
+		void							SetBacklogProbe(const std::function<size_t()>& probe);
+
+		/**
+		* 获取当前连接数
+		*/
+		size_t						GetSessionCount();
+
+		/**
+		* 获取被拒绝的连接数
+		* @reason EAdmission::Accept 表示所有原因的总数
+		*/
+		uint64_t						GetRejectedCount(EAdmission reason = EAdmission::Accept);
+
+		/**
+		* 获取因过载暂停accept的次数
+		*/
+		uint64_t						GetPausedCount();
 	protected:
 		/**
-		* Ͷ첽accept,
+		* 投递异步accept,接受网络连接
 		*/
 		void							PostAccept();
+
+		/**
+		* 检测是否允许新的连接
+		* @ip 新连接的地址, 为空时不检测IP连接频率
+		*/
+		EAdmission					CheckAdmission(const std::string& ip);
 	protected:
 		struct Imp;
 		std::shared_ptr<Imp>  m_Imp;
@@ -13,7 +13,7 @@ Licensed under the MIT License <http://opensource.org/licenses/MIT>.
 using namespace moon;
 
 NetworkService::NetworkService()
-	:m_IoWork(m_IoService),m_Checker(m_IoService), m_TimeOut(0),m_IncreaseSessionID(0)
+	:m_IoWork(m_IoService),m_Checker(m_IoService), m_TimeOut(0),m_IncreaseSessionID(0),m_SessionCount(0)
 {
 
 }
@@ -50,6 +50,7 @@ void NetworkService::AddSession(const SessionPtr& sessionPtr)
 			assert(0);
 			//SessionID repeated.
 		}	
+		m_SessionCount = m_Sessions.size();
 	});
 }
 
@@ -60,6 +61,7 @@ void NetworkService::RemoveSession(SessionID sessionID)
 		{
 			m_Sessions.erase(sessionID);
 		}
+		m_SessionCount = m_Sessions.size();
 	});
 }
 
@@ -68,18 +70,30 @@ void moon::NetworkService::SetTimeout(uint32_t timeout)
 	m_TimeOut = timeout;
 }
 
-void NetworkService::Send(SessionID sessionID, const MemoryStreamPtr& msg)
+void NetworkService::SetRateLimit(const RateLimitConfig& cfg)
 {
-	m_IoService.post([this, sessionID, msg]()
+	m_IoService.post([this, cfg]() {
+		m_RateLimit = cfg;
+	});
+}
+
+void NetworkService::Send(SessionID sessionID, const MemoryStreamPtr& msg, ESendPriority priority, uint64_t traceID)
+{
+	m_IoService.post([this, sessionID, msg, priority, traceID]()
 	{
 		auto iter = m_Sessions.find(sessionID);
 		if (iter != m_Sessions.end())
 		{
-			iter->second->Send(msg);
+			iter->second->Send(msg, priority, traceID);
 		}
 	});
 }
 
+void NetworkService::Post(const std::function<void()>& handler)
+{
+	m_IoService.post(handler);
+}
+
 void NetworkService::Run()
 {
 	if (m_TimeOut != 0)
@@ -95,14 +109,31 @@ void NetworkService::Run()
 
 void NetworkService::Stop()
 {
+	//先关闭所有连接，再停止 io_service, 否则关闭操作可能不会被执行
 	m_IoService.post([this]() {
 		for (auto& iter : m_Sessions)
 		{
 			iter.second->Close(ESocketState::Ok);
 		}
 		m_Sessions.clear();
+		m_SessionCount = 0;
+		m_IoService.stop();
+	});
+}
+
+void NetworkService::Drain()
+{
+	m_IoService.post([this]() {
+		for (auto& iter : m_Sessions)
+		{
+			iter.second->Shutdown();
+		}
 	});
-	m_IoService.stop();
+}
+
+size_t NetworkService::GetSessionCount()
+{
+	return m_SessionCount.load();
 }
 
 void NetworkService::CloseSession(SessionID sessionID, ESocketState state)
@@ -129,7 +160,7 @@ void moon::NetworkService::TimeoutChecker(const asio::error_code &)
 		int64_t diff = curSec - iter.second->GetLastRecevieTime();
 		if (diff >= m_TimeOut)
 		{
-			//Ͷsocketӹر󣬴˲첽
+			//投递socket连接关闭请求，此操作是异步的
 			iter.second->Close(ESocketState::Timeout);
 		}
 	}
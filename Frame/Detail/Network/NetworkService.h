@@ -17,7 +17,7 @@ namespace moon
 {
 	DECLARE_SHARED_PTR(Session);
 	DECLARE_SHARED_PTR(memory_stream);
-	//asio::io_services ķװ  һ߳һNetworkService
+	//asio::io_services 的封装 ， 一条线程一个NetworkService
 	class NetworkService
 	{
 	public:
@@ -29,57 +29,87 @@ namespace moon
 		void Stop();
 
 		/**
-		* ȡasio::io_services
+		* 优雅关闭所有连接：发送完队列中的数据后关闭写端，等待对端关闭连接
+		*
+		*/
+		void Drain();
+
+		/**
+		* 获取连接数量
+		*
+		*/
+		size_t GetSessionCount();
+
+		/**
+		* 获取asio::io_services
 		*
 		* @return asio::io_services
 		*/
 		asio::io_service&	GetIoService();
 		/**
-		* NetworkService Session
+		* 向这个NetworkService添加 Session
 		*
 		* @session 
 		*/
 		void			AddSession(const SessionPtr& session);
 
 		/**
-		* ƳSession
+		* 移除Session
 		*
-		* @sessionID SessionΨһʶ
+		* @sessionID Session的唯一标识符
 		*/
 		void			RemoveSession(SessionID sessionID);
 
 		/**
-		* óʱ
+		* 设置超时间隔
 		*
-		* @timeout ʱ s
+		* @timeout 超时间隔 s
 		*/
 		void			SetTimeout(uint32_t timeout);
 
 		/**
-		* ĳsocket 
+		* 设置每个连接的接收频率限制
+		*
+		* @cfg
+		*/
+		void			SetRateLimit(const RateLimitConfig& cfg);
+
+		const RateLimitConfig& GetRateLimit() { return m_RateLimit; }
+
+		/**
+		* 向某个socket连接 发送数据
 		*
 		* @socketID
-		* @buffer_ptr 
+		* @buffer_ptr 数据
+		* @priority 发送优先级
+		* @traceID 见 Session::Send
+		*/
+		void			Send(SessionID sessionID, const MemoryStreamPtr& msg, ESendPriority priority = ESendPriority::Urgent, uint64_t traceID = 0);
+
+		/**
+		* 在该NetworkService的网络线程中执行 handler
+		*
+		* @handler
 		*/
-		void			Send(SessionID sessionID, const MemoryStreamPtr& msg);
+		void			Post(const std::function<void()>& handler);
 
 		/**
-		* رĳsocket
+		* 关闭某个socket连接
 		*
 		* @sessionID 
-		* @state ùر״̬
+		* @state 设置关闭状态
 		*/
 		void			CloseSession(SessionID sessionID, ESocketState why);
 
 		/**
-		* ȡserviceID
+		* 获取serviceID
 		*
 		*/
 
 		PROPERTY_READWRITE(uint32_t, m_ID, ID)
 	private:
 		/**
-		* ʱ
+		* 超时检测
 		*
 		*/
 		void			TimeoutChecker(const asio::error_code&);
@@ -90,7 +120,9 @@ namespace moon
 		asio::steady_timer														m_Checker;
 		std::unordered_map<SessionID, SessionPtr>				m_Sessions;
 		uint32_t																		m_TimeOut;
+		RateLimitConfig															m_RateLimit;
 		uint32_t																		m_IncreaseSessionID;
+		std::atomic<size_t>														m_SessionCount;
 	};
 }
 
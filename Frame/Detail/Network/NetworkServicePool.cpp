@@ -44,8 +44,29 @@ void NetworkServicePool::Run()
 	}
 }
 
-void NetworkServicePool::Stop()
+void NetworkServicePool::Stop(uint32_t drainTimeout)
 {
+	if (drainTimeout > 0)
+	{
+		for (auto iter : m_Services)
+		{
+			iter.second->Drain();
+		}
+
+		// Wait until all peers closed their connections or the deadline expired.
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(drainTimeout);
+		while (std::chrono::steady_clock::now() < deadline)
+		{
+			size_t count = 0;
+			for (auto iter : m_Services)
+			{
+				count += iter.second->GetSessionCount();
+			}
+			BREAK_IF(count == 0);
+			thread_sleep(10);
+		}
+	}
+
 	// Explicitly stop all io_services. 
 	for (auto iter : m_Services)
 	{
@@ -61,13 +82,13 @@ void NetworkServicePool::Stop()
 	}
 }
 
-void moon::NetworkServicePool::Send(SessionID sessionID, const MemoryStreamPtr& msg)
+void moon::NetworkServicePool::Send(SessionID sessionID, const MemoryStreamPtr& msg, ESendPriority priority, uint64_t traceID)
 {
 	uint8_t servicesid = (sessionID >> 24)&0xFF;
 	auto iter = m_Services.find(servicesid);
 	if (iter != m_Services.end())
 	{
-		iter->second->Send(sessionID, msg);
+		iter->second->Send(sessionID, msg, priority, traceID);
 	}
 }
 
@@ -81,6 +102,16 @@ void moon::NetworkServicePool::CloseSession(SessionID sessionID, ESocketState st
 	}
 }
 
+void moon::NetworkServicePool::Post(SessionID sessionID, const std::function<void()>& handler)
+{
+	uint8_t servicesid = (sessionID >> 24) & 0xFF;
+	auto iter = m_Services.find(servicesid);
+	if (iter != m_Services.end())
+	{
+		iter->second->Post(handler);
+	}
+}
+
 NetworkService& NetworkServicePool::PollAService()
 {
 	// Use a round-robin scheme to choose the next io_service to use. 
@@ -24,12 +24,18 @@ namespace moon
 
 		void Run();
 
-		void Stop();
+		/**
+		* 停止所有网络线程
+		* @drainTimeout 大于0时先优雅关闭所有连接，最多等待 drainTimeout 毫秒
+		*/
+		void Stop(uint32_t drainTimeout = 0);
 
-		void	Send(SessionID sessionID, const MemoryStreamPtr& msg);
+		void	Send(SessionID sessionID, const MemoryStreamPtr& msg, ESendPriority priority = ESendPriority::Urgent, uint64_t traceID = 0);
 
 		void	CloseSession(SessionID sessionID, ESocketState state);
 
+		void	Post(SessionID sessionID, const std::function<void()>& handler);
+
 		NetworkService& PollAService();
 
 		NetworkServiceMap& GetServices() { return m_Services; }
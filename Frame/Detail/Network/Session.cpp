@@ -12,6 +12,7 @@ Licensed under the MIT License <http://opensource.org/licenses/MIT>.
 #include "Detail/Log/Log.h"
 #include "Common/BinaryWriter.hpp"
 #include "Common/TupleUtils.hpp"
+#include "Detail/Module/Tracer.h"
 
 namespace moon
 {
@@ -21,7 +22,15 @@ namespace moon
 		,m_Socket(networkService.GetIoService())
 		,m_RecvMemoryStream(IO_BUFFER_SIZE)
 		,m_SendMemoryStream(IO_BUFFER_SIZE)
+		, m_PartialQueue(nullptr)
+		, m_PartialOffset(0)
 		, m_IsSending(false)
+		, m_IsDraining(false)
+		, m_IsSendShutdown(false)
+		, m_ResumeTimer(networkService.GetIoService())
+		, m_FrameTokens(0)
+		, m_ByteTokens(0)
+		, m_TokenTime(0)
 		,m_State(ESocketState::Ok)	
 	{
 		LOG_TRACE("Create Session");
@@ -56,7 +65,7 @@ namespace moon
 		{
 			CONSOLE_TRACE("Session address[%s] forced closed, state[%d]", GetRemoteIP().c_str(), (int)state);
 			m_State = state;
-			//첽̵ã asio::error::operation_aborted
+			//所有异步处理将会立刻调用，并触发 asio::error::operation_aborted
 			m_Socket.shutdown(asio::ip::tcp::socket::shutdown_both, m_ErrorCode);
 			if (m_ErrorCode)
 			{
@@ -68,6 +77,9 @@ namespace moon
 				CONSOLE_TRACE("Session address[%s] close failed:%s.", GetRemoteIP().c_str(), m_ErrorCode.message().c_str());
 			}
 			LOG_TRACE("Session address[%s] close success.", GetRemoteIP().c_str());
+			//暂停读取时没有未完成的读请求，由 m_ResumeTimer 的回掉通知关闭
+			asio::error_code ec;
+			m_ResumeTimer.cancel(ec);
 		}
 	}
 
@@ -106,6 +118,14 @@ namespace moon
 		RefreshLastRecevieTime();
 		m_RecvMemoryStream.WriteBack(m_RecvBuffer, 0, bytes_transferred);
 
+		if (ParseMessages())
+		{
+			PostRead();
+		}
+	}
+
+	bool Session::ParseMessages()
+	{
 		while (m_RecvMemoryStream.Size() > sizeof(msg_size_t))
 		{
 			msg_size_t size = *(msg_size_t*)m_RecvMemoryStream.Data();
@@ -116,21 +136,109 @@ namespace moon
 			{
 				m_State = ESocketState::IllegalDataLength;
 				OnClose();
-				return;
+				return false;
 			}
 			
-			//Ϣ Ϣ
+			//消息不完整 继续接收消息
 			if (m_RecvMemoryStream.Size() < sizeof(msg_size_t) + size)
 			{
 				break;
 			}
 
+			//在创建消息之前检测接收频率
+			auto wait = CheckRateLimit(size);
+			if (0 != wait)
+			{
+				switch (m_Service.GetRateLimit().Action)
+				{
+				case ERateLimitAction::Drop:
+				{
+					m_RecvMemoryStream.Seek(sizeof(msg_size_t) + size, MemoryStream::Current);
+					continue;
+				}
+				case ERateLimitAction::Pause:
+				{
+					//不再读取数据，由TCP流量控制限制对端的发送速度
+					m_ResumeTimer.expires_from_now(std::chrono::milliseconds(wait));
+					m_ResumeTimer.async_wait([this, self = shared_from_this()](const asio::error_code& e) {
+						if (e || !IsOk())
+						{
+							//只因为 !IsOk() 关闭时保留原来的关闭原因
+							if (e)
+							{
+								m_ErrorCode = e;
+							}
+							OnClose();
+							return;
+						}
+						if (ParseMessages())
+						{
+							PostRead();
+						}
+					});
+					return false;
+				}
+				default:
+				{
+					CONSOLE_TRACE("Session address[%s] exceeds the receive rate limit.", GetRemoteIP().c_str());
+					m_State = ESocketState::RateLimited;
+					OnClose();
+					return false;
+				}
+				}
+			}
+
 			m_RecvMemoryStream.Seek(sizeof(msg_size_t), MemoryStream::Current);
 			OnMessage(m_RecvMemoryStream.Data(), size);
 			m_RecvMemoryStream.Seek(size, MemoryStream::Current);
 		}
+		return true;
+	}
+
+	int64_t Session::CheckRateLimit(size_t len)
+	{
+		auto& cfg = m_Service.GetRateLimit();
+		if (0 == cfg.FramesPerSecond && 0 == cfg.BytesPerSecond)
+		{
+			return 0;
+		}
 
-		PostRead();	
+		int64_t fps = cfg.FramesPerSecond;
+		int64_t bps = cfg.BytesPerSecond;
+		auto now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+
+		//令牌桶容量为1秒的流量
+		if (0 == m_TokenTime)
+		{
+			m_FrameTokens = fps * 1000;
+			m_ByteTokens = bps * 1000;
+		}
+		else
+		{
+			auto elapsed = now - m_TokenTime;
+			m_FrameTokens = std::min(m_FrameTokens + elapsed * fps, fps * 1000);
+			m_ByteTokens = std::min(m_ByteTokens + elapsed * bps, bps * 1000);
+		}
+		m_TokenTime = now;
+
+		int64_t wait = 0;
+		if (0 != fps && m_FrameTokens < 1000)
+		{
+			wait = std::max(wait, (1000 - m_FrameTokens + fps - 1) / fps);
+		}
+
+		//字节令牌允许透支，否则大于 BytesPerSecond 的消息永远无法接收
+		if (0 != bps && m_ByteTokens <= 0)
+		{
+			wait = std::max(wait, -m_ByteTokens / bps + 1);
+		}
+
+		if (0 == wait)
+		{
+			m_FrameTokens -= (0 != fps) ? 1000 : 0;
+			m_ByteTokens -= (0 != bps) ? (int64_t)len * 1000 : 0;
+		}
+		return wait;
 	}
 
 	void Session::PostSend()
@@ -141,16 +249,61 @@ namespace moon
 			return;
 		}
 		
-		if (m_SendQueue.size() == 0)
+		if (m_SendQueue.size() == 0 && m_BulkQueue.size() == 0)
+		{
+			if (m_IsDraining)
+			{
+				ShutdownSend();
+			}
 			return;
+		}
 
 		m_SendMemoryStream.Clear();
 
-		while ((m_SendQueue.size() > 0) && (m_SendMemoryStream.Size() + m_SendQueue.front()->Size() <= IO_BUFFER_SIZE))
+		//每次最多发送 IO_BUFFER_SIZE 字节，超过的消息分片发送。
+		//紧急消息优先，在每条消息的边界都会重新检查紧急消息队列
+		while (m_SendMemoryStream.Size() + sizeof(msg_size_t) < (size_t)IO_BUFFER_SIZE)
 		{
-			auto& msg = m_SendQueue.front();
-			m_SendMemoryStream.WriteBack(msg->Data(),0,msg->Size());
-			m_SendQueue.pop_front();
+			auto queue = m_PartialQueue;
+			if (nullptr == queue)
+			{
+				if (m_SendQueue.size() > 0)
+				{
+					queue = &m_SendQueue;
+				}
+				else if (m_BulkQueue.size() > 0)
+				{
+					queue = &m_BulkQueue;
+				}
+				else
+				{
+					break;
+				}
+
+				msg_size_t msgsize = static_cast<msg_size_t>(queue->front()->Size());
+				m_SendMemoryStream.WriteBack(&msgsize, 0, 1);
+			}
+
+			//发送的 MemoryStream 可能和 Module 消息共享，只记录发送位置，不修改它
+			auto& msg = queue->front();
+			size_t len = std::min((size_t)msg->Size() - m_PartialOffset, (size_t)IO_BUFFER_SIZE - m_SendMemoryStream.Size());
+			m_SendMemoryStream.WriteBack(msg->Data() + m_PartialOffset, 0, len);
+			m_PartialOffset += len;
+
+			if (m_PartialOffset == msg->Size())
+			{
+				if (!m_TracedQueue.empty())
+				{
+					TakeTraced(msg.get());
+				}
+				queue->pop_front();
+				m_PartialQueue = nullptr;
+				m_PartialOffset = 0;
+			}
+			else
+			{
+				m_PartialQueue = queue;
+			}
 		}
 
 		if (0 == m_SendMemoryStream.Size())
@@ -173,6 +326,11 @@ namespace moon
 		m_IsSending = false;
 		if (!e)
 		{
+			for (auto traceID : m_TracedWriting)
+			{
+				Tracer::Instant(traceID, "write", m_ID);
+			}
+			m_TracedWriting.clear();
 			PostSend();
 			return;
 		}
@@ -180,6 +338,37 @@ namespace moon
 		OnClose();
 	}
 
+	void Session::Shutdown()
+	{
+		if (!m_Socket.is_open() || m_IsDraining)
+		{
+			return;
+		}
+
+		m_IsDraining = true;
+
+		if (!m_IsSending)
+		{
+			PostSend();
+		}
+	}
+
+	void Session::ShutdownSend()
+	{
+		if (m_IsSendShutdown || !m_Socket.is_open())
+		{
+			return;
+		}
+
+		m_IsSendShutdown = true;
+		//关闭写端，对端会读到 EOF，之后由对端关闭连接
+		m_Socket.shutdown(asio::ip::tcp::socket::shutdown_send, m_ErrorCode);
+		if (m_ErrorCode)
+		{
+			CONSOLE_TRACE("Session address[%s] shutdown send failed:%s.", GetRemoteIP().c_str(), m_ErrorCode.message().c_str());
+		}
+	}
+
 	bool Session::IsOk()
 	{
 		if (m_ErrorCode || m_State != ESocketState::Ok)
@@ -189,35 +378,44 @@ namespace moon
 		return true;
 	}
 
-	void Session::Send(const MemoryStreamPtr& msg)
+	void Session::TakeTraced(const MemoryStream* msg)
 	{
+		for (auto it = m_TracedQueue.begin(); it != m_TracedQueue.end(); ++it)
+		{
+			if (it->first == msg)
+			{
+				m_TracedWriting.push_back(it->second);
+				m_TracedQueue.erase(it);
+				return;
+			}
+		}
+	}
+
+	void Session::Send(const MemoryStreamPtr& msg, ESendPriority priority, uint64_t traceID)
+	{
+		if (m_IsSendShutdown)
+		{
+			LOG_TRACE("Session address[%s] is shutdown, message will not send!", GetRemoteIP().c_str());
+			return;
+		}
+
 		if (msg->Size() > MAX_MSG_SIZE)
 		{
 			CONSOLE_TRACE("Warning: try to send %lluByte message, the max limit is %lluByte, this message will not send!", msg->Size(),MAX_MSG_SIZE);
 			return;
 		}
 
+		if (0 != traceID)
 		{
-			msg_size_t msgsize = static_cast<msg_size_t>(msg->Size());
-			size_t buffsize = (msgsize > (IO_BUFFER_SIZE - sizeof(msg_size_t)))? (IO_BUFFER_SIZE - sizeof(msg_size_t)) : msgsize;
-			MemoryStreamPtr splitmsg = ObjectCreateHelper<MemoryStream>::Create(buffsize+ sizeof(msg_size_t));		
-			splitmsg->WriteBack(&msgsize, 0,1);
-			splitmsg->WriteBack(msg->Data(), 0, buffsize);
-			msg->Seek(static_cast<int>(buffsize), MemoryStream::seek_origin::Current);
-			m_SendQueue.emplace_back(splitmsg);
+			m_TracedQueue.emplace_back(msg.get(), traceID);
 		}
 
-		while (msg->Size() > 0)
+		//消息在 PostSend 中加上长度并分片写入发送缓冲区
+		if (priority == ESendPriority::Bulk)
 		{
-			msg_size_t msgsize = static_cast<msg_size_t>(msg->Size());
-			size_t buffsize = (msgsize > IO_BUFFER_SIZE) ? IO_BUFFER_SIZE: msgsize;
-			MemoryStreamPtr splitmsg = ObjectCreateHelper<MemoryStream>::Create(buffsize);
-			splitmsg->WriteBack(msg->Data(), 0, buffsize);
-			msg->Seek(static_cast<int>(buffsize), MemoryStream::seek_origin::Current);
-			m_SendQueue.emplace_back(splitmsg);
+			m_BulkQueue.push_back(msg);
 		}
-
-		if (msg->Size() != 0)
+		else
 		{
 			m_SendQueue.push_back(msg);
 		}
@@ -9,6 +9,7 @@ Licensed under the MIT License <http://opensource.org/licenses/MIT>.
 
 #pragma once
 #include "asio.hpp"
+#include "asio/steady_timer.hpp"
 #include "NetworkDefine.h"
 
 
@@ -18,7 +19,7 @@ namespace moon
 
 	constexpr int32_t			IO_BUFFER_SIZE = 8192;
 
-	//asio::socket ķװ
+	//asio::socket 的封装
 	class NetworkService;
 	class Session :public std::enable_shared_from_this<Session>,private asio::noncopyable
 	{	
@@ -29,93 +30,129 @@ namespace moon
 		~Session(void);
 
 		/**
-		* ӳɹô˺һЩʼ
+		* 连接成功后调用此函数，可以做一些初始化工作
 		*
 		* @return ,if return true will add to NetworkService else will close
 		*/
 		bool											Start();
 
 		/**
-		* ǿƹرոsocket
+		* 强制关闭该socket连接
 		*
-		* @state һر״̬
+		* @state 设置一个关闭状态
 		*/
 		void											Close(ESocketState state);
 
 		/**
-		* socketӷ
+		* 向该socket连接发送数据
 		*
+		* @data 数据
+		* @priority 发送优先级
+		* @traceID 不为 0 时, 包含这条数据的写入完成后记录追踪事件 "write"
 		*/
-		void											Send(const MemoryStreamPtr& data);
+		void											Send(const MemoryStreamPtr& data, ESendPriority priority = ESendPriority::Urgent, uint64_t traceID = 0);
 
 		/**
-		* ȡasio::ip::tcp::socket
+		* 优雅关闭：发送队列中的数据发送完成后，关闭写端（发送 FIN），
+		* 继续读取直到对端关闭连接
+		*
+		*/
+		void											Shutdown();
+
+		/**
+		* 获取asio::ip::tcp::socket
 		*
 		*/
 		asio::ip::tcp::socket&				GetSocket() { return m_Socket; };
 
 		/**
-		* ȡϢ
+		* 获取错误信息
 		*
 		*/
 		std::string									GetErrorMessage() { return m_ErrorCode.message(); }
 
 		/**
-		* ӵ״̬
+		* 检测这个网络连接的状态
 		*
 		*/
 		bool											IsOk();
 	private:
 		/**
-		* Ͷ첽
+		* 投递异步读请求
 		*
 		*/
 		void											PostRead();
 
 		/**
-		* Ͷ첽д
+		* 投递异步写请求
 		*
 		*/
 		void											PostSend();
 
 		/**
-		* ȡɻص
+		* 读取完成回掉
 		*
 		*/
 		void											HandleRead(const asio::error_code& e, std::size_t bytes_transferred);
 
 		/**
-		* дɻص
+		* 解析接收缓冲区中完整的消息
+		*
+		* @return 返回 false 时不再继续投递读请求（连接关闭或者暂停读取）
+		*/
+		bool											ParseMessages();
+
+		/**
+		* 接收频率检测(令牌桶)，允许接收时消耗令牌
+		*
+		* @len 消息长度
+		* @return 0 允许接收，否则返回需要等待的毫秒数
+		*/
+		int64_t										CheckRateLimit(size_t len);
+
+		/**
+		* 写完成回掉
 		*
 		*/
 		void											HandleSend(const asio::error_code& e, std::size_t bytes_transferred);
+
+		/**
+		* 追踪的消息完整写入发送缓冲区, 写入完成后记录
+		*/
+		void											TakeTraced(const MemoryStream* msg);
+
+		/**
+		* 关闭写端
+		*
+		*/
+		void											ShutdownSend();
 	
 		/**
-		* ˢյݵʱ
+		* 刷新最后接收到到数据的时间
 		*
 		*/
 		void											RefreshLastRecevieTime();
 
 		/**
-		* ӳɹ,͹رϢģ
+		* 连接成功,发送关闭消息给模块
 		*
 		*/
 		void											OnConnect();
 
 		/**
-		* յϢ,͹رϢģ
+		* 接收到消息,发送关闭消息给模块
 		*
 		*/
 		void											OnMessage(const uint8_t* data,size_t len);
 
 		/**
-		* ӽҪر,͹رϢģ
+		* 连接将要关闭,发送关闭消息给模块
 		*
 		*/
 		void											OnClose();
 
 		/**
-		* Զ̵ĵַ
+		* 解析远程的地址
 		*
 		*/
 		void											ParseRemoteEndPoint();
@@ -129,24 +166,43 @@ namespace moon
 		PROPERTY_READONLY(std::string, m_RemoteIP, RemoteIP)
 		PROPERTY_READONLY(uint16_t, m_RemotePort, RemotePort)
 	private:
-		//Ϣ
+		//消息处理函数对象
 		NetMessageDelegate&			m_Delegate;
 
 		NetworkService&						m_Service;
 
 		asio::ip::tcp::socket					m_Socket;
-		//첽ջ
+		//异步接收缓冲区
 		uint8_t										m_RecvBuffer[IO_BUFFER_SIZE];
-		//Ϣ
+		//接收消息缓冲区
 		MemoryStream						m_RecvMemoryStream;
-		//ͻ
+		//发送缓冲区
 		MemoryStream						m_SendMemoryStream;
-		//ϢͶ
+		//紧急消息发送队列
 		std::deque<MemoryStreamPtr>	m_SendQueue;
-		//Ƿڷ
+		//大数据发送队列
+		std::deque<MemoryStreamPtr>	m_BulkQueue;
+		//只发送了一部分的消息所在的队列，必须先发送完这个消息，对端才能解析
+		std::deque<MemoryStreamPtr>*	m_PartialQueue;
+		//只发送了一部分的消息已经发送的长度
+		size_t										m_PartialOffset;
+		//还在发送队列中的追踪的消息, 和已经写入发送缓冲区、等待写入完成的 TraceID。 只有采样的消息才有, 平时为空
+		std::vector<std::pair<const MemoryStream*, uint64_t>>	m_TracedQueue;
+		std::vector<uint64_t>				m_TracedWriting;
+		//是否正在发送
 		bool											m_IsSending;
-		//
+		//是否正在优雅关闭
+		bool											m_IsDraining;
+		//写端是否已经关闭
+		bool											m_IsSendShutdown;
+		//网络错误
 		asio::error_code						m_ErrorCode;
+		//超过接收频率限制时，用于恢复读取
+		asio::steady_timer						m_ResumeTimer;
+		//令牌数量（放大1000倍），和上次补充令牌的时间 ms
+		int64_t										m_FrameTokens;
+		int64_t										m_ByteTokens;
+		int64_t										m_TokenTime;
 
 		ESocketState							 m_State;
 	};
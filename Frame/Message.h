@@ -10,36 +10,50 @@ Licensed under the MIT License <http://opensource.org/licenses/MIT>.
 #pragma once
 #include "MacroDefine.h"
 #include "Common/MemoryStream.hpp"
+#include <cstring>
 
 namespace moon
 {
-	//ModuleϢ
+	//Module消息类型
 	enum class EMessageType :uint8_t
 	{
 		Unknown,
-		NetworkData,//
-		NetworkConnect,//Ϣ
-		NetworkClose,//ϿϢ
-		ModuleData,//Module
-		ModuleRPC,//Զ̵Ϣ
-		ToClient//͸ͻ˵
+		NetworkData,//网络数据
+		NetworkConnect,//网络连接消息
+		NetworkClose,//网络断开消息
+		ModuleData,//Module数据
+		ModuleRPC,//远程调用消息
+		ToClient,//发送给客户端的数据
+		NetworkDrain,//网络即将关闭，不再接受新连接
+		ModuleRPCTimeout,//远程调用超时, 由发送请求的 Module 自己产生, 见 Module::SendRPC
+		ModuleNameChanged//WatchName 关注的名字重新绑定, data 是名字, sender 是新绑定的 Module, 0 表示已解除绑定
+	};
+
+	//Module消息优先级, 高优先级的消息在接收者的邮箱中先处理
+	enum class EMessagePriority :uint8_t
+	{
+		Normal,
+		High//RPC 回应，系统消息
 	};
 
 	DECLARE_SHARED_PTR(MemoryStream)
 
-	//Module Ϣ
+	//Module 消息。 消息头在前 64 字节内; 数据和 userdata 的总长度不超过 INLINE_SIZE 时
+	//直接保存在消息对象中，不需要额外分配内存，更大的数据保存在共享的 MemoryStream 中
 	class Message
 	{
 	public:
 		using StreamType = MemoryStream;
 
+		constexpr static size_t INLINE_SIZE = 128;
+
 		Message(size_t capacity = 64, size_t headreserved = 0);
 
 		Message(const MemoryStreamPtr&);
 
-		Message(const Message& msg) = default;
+		Message(const Message& msg) = delete;
 
-		Message(Message&& msg) = default;
+		Message& operator=(const Message& msg) = delete;
 
 		~Message();
 
@@ -50,21 +64,36 @@ namespace moon
 		ModuleID							GetReceiver() const;
 
 		void									SetUserData(const std::string& userdata);
-		const std::string&			GetUserData() const;
+		std::string							GetUserData() const;
+
+		const uint8_t*					UserData() const;
+		size_t								UserDataSize() const;
 
 		void									SetRPCID(uint64_t rpcID);
 		uint64_t							GetRPCID() const;
 
 		/**
-		* Ϣͣμ EMessageType
+		* 消息流程追踪的 ID, 0 表示没有追踪, 见 Tracer
+		*/
+		void									SetTraceID(uint64_t traceID);
+		uint64_t							GetTraceID() const;
+
+		/**
+		* 设置消息类型，参见 EMessageType
 		*/
 		void									SetType(EMessageType type);
 		EMessageType					GetType() const;
 
+		/**
+		* 设置消息优先级。 ModuleRPC, ModuleRPCTimeout 类型的消息总是高优先级
+		*/
+		void									SetPriority(EMessagePriority priority);
+		EMessagePriority				GetPriority() const;
+
 	
 		const uint8_t*					Data() const
 		{
-			return m_Data->Data();
+			return (nullptr == m_Data) ? m_Inline : m_Data->Data();
 		}
 
 		std::string							Bytes() const
@@ -74,26 +103,65 @@ namespace moon
 
 		void									WriteData(const std::string& v)
 		{
-			m_Data->WriteBack(v.data(),0, v.size());
+			WriteData((const uint8_t*)v.data(), v.size());
 		}
 
+		void									WriteData(const uint8_t* data, size_t len);
+
 		size_t								Size() const
 		{
-			return m_Data->Size();
+			return (nullptr == m_Data) ? m_InlineSize : m_Data->Size();
+		}
+
+		/**
+		* 保存数据的 MemoryStream, 数据保存在消息对象中时返回 nullptr。
+		* 这个 MemoryStream 可能被多个消息共享，不能修改
+		*/
+		const MemoryStreamPtr&		GetStream() const
+		{
+			return m_Data;
+		}
+
+		/**
+		* 读取 offset 处的数据，不移动读位置。 越界时抛出异常
+		*/
+		template<typename T>
+		T										Read(size_t offset) const
+		{
+			static_assert(std::is_pod<T>::value, "type T must be pod.");
+			Assert(offset <= Size() && sizeof(T) <= Size() - offset, "Message::Read out of range");
+			T v;
+			memcpy(&v, Data() + offset, sizeof(T));
+			return v;
+		}
+
+		std::string							ReadString(size_t offset, size_t len) const
+		{
+			Assert(offset <= Size() && len <= Size() - offset, "Message::ReadString out of range");
+			return std::string((const char*)Data() + offset, len);
 		}
 
 	protected:
 		void									Init();
+
+		//数据放不下时移到 MemoryStream 中
+		void									Spill(size_t capacity);
 	protected:
+		//标志位, 见 Message.cpp 中的 MESSAGE_FLAG_XXX
 		uint8_t								m_Flag;
 		uint8_t								m_Type;
+		uint16_t							m_UserDataSize;
+		//m_Inline 中数据的长度
+		uint32_t							m_InlineSize;
 		ModuleID							m_Sender;
 		ModuleID							m_Receiver;
-		uint64_t							m_UserID;
-		uint64_t							m_SubUserID;
 		uint64_t							m_RPCID;
-		std::string							m_UserData;
+		uint64_t							m_TraceID;
 		MemoryStreamPtr			m_Data;
+		//userdata 在 m_Inline 中放不下时从 MemoryPool 分配
+		uint8_t*							m_ExtUserData;
+		//数据从前向后保存，userdata 保存在末尾
+		uint8_t								m_Inline[INLINE_SIZE];
 	};
 };
 
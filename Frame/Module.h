@@ -13,6 +13,7 @@ Licensed under the MIT License <http://opensource.org/licenses/MIT>.
 namespace moon
 {
 	class ModuleManager;
+	class Worker;
 	DECLARE_SHARED_PTR(Message);
 
 	class  Module :public noncopyable
@@ -27,15 +28,105 @@ namespace moon
 		ModuleID 				GetID() const;
 		const std::string		GetName() const;
 
+		/**
+		*	enable or disable Update callbacks. modules that disable Update cost nothing per Worker tick.
+		*	must be called in the module's Worker thread (or before the module is added)
+		*/
 		void							SetEnableUpdate(bool);
 		bool							IsEnableUpdate();
 
-		void							Send(ModuleID receiver, const std::string& data, const std::string& userdata, uint64_t rpcID, uint8_t type);
+		/**
+		*	set the Update interval in ms, 0 means every Worker tick
+		*/
+		void							SetUpdateInterval(uint32_t interval);
+		uint32_t					GetUpdateInterval();
+
+		/**
+		*	handle up to n queued messages per scheduling turn with one OnMessageBatch call.
+		*	0 or 1 handles one message per turn with OnMessageEx
+		*/
+		void							SetMessageBatch(uint32_t n);
+		uint32_t					GetMessageBatch();
+
+		/**
+		*	@priority EMessagePriority, high priority messages are handled before normal ones by the receiver.
+		*	ModuleRPC messages are always high priority
+		*/
+		void							Send(ModuleID receiver, const std::string& data, const std::string& userdata, uint64_t rpcID, uint8_t type, uint8_t priority = 0);
+
+		/**
+		*	send the payload of a received Message to another module. payloads kept in a MemoryStream are shared, not copied
+		*/
+		void							Forward(ModuleID receiver, const MessagePtr& msg, const std::string& userdata, uint64_t rpcID, uint8_t type);
+
+		/**
+		*	send a request and track its reply. the receiver answers with Send(sender, ..., rpcID, ModuleRPC).
+		*	if no reply arrives in timeout ms, a ModuleRPCTimeout message with the same rpcID is delivered
+		*	to this module instead, and a late reply is dropped. timeout 0 never expires.
+		*	must be called in the module's Worker thread
+		*	@return rpcID
+		*/
+		uint64_t					SendRPC(ModuleID receiver, const std::string& data, const std::string& userdata, uint32_t timeout);
+
+		/**
+		*	stop waiting for a request, its reply will be dropped.
+		*	@return false if the request already completed or timed out
+		*/
+		bool							CancelRPC(uint64_t rpcID);
+
+		uint32_t					GetPendingRPC();
+
+		/**
+		*	key-value: pending;sent;replied;timeout;cancelled;late(replies dropped after timeout or cancel);
+		*	avg_us,max_us(reply latency in microseconds);
+		*/
+		std::string					GetRPCStats();
+
+		/**
+		*	key-value: in;out;bytes_in;bytes_out(messages handled and sent);queue_max(mailbox high-watermark);
+		*	handle;handle_ns;handle_p50_ns;handle_p99_ns;handle_max_ns(OnMessageEx or OnMessageBatch calls and time);
+		*	update;update_ns;update_p50_ns;update_p99_ns;update_max_ns;
+		*	empty until ModuleManager::SetModuleStats(true). thread safe
+		*/
+		std::string					GetStats();
+
+		/**
+		*	bind name to this module in the ModuleManager's name registry, see ModuleManager::RegisterName
+		*/
+		void							RegisterName(const std::string& name);
+
+		void							UnregisterName(const std::string& name);
+
+		/**
+		*	@return the module bound to name, 0 if none. cheap enough to call per message
+		*/
+		ModuleID					GetModuleByName(const std::string& name);
+
+		/**
+		*	receive a ModuleNameChanged message whenever name is rebound or unbound.
+		*	@return the module bound to name now, 0 if none
+		*/
+		ModuleID					WatchName(const std::string& name);
+
+		void							UnwatchName(const std::string& name);
 
 		void							SendByCache(ModuleID receiver, uint32_t cacheID, const std::string& userdata, uint64_t rpcID, uint8_t type);
 
 		void							Broadcast(const std::string& data, const std::string& userdata, uint8_t type);
 
+		/**
+		*	receive the messages published to topic, see ModuleManager::Subscribe
+		*/
+		void							Subscribe(uint32_t topic);
+
+		void							Unsubscribe(uint32_t topic);
+
+		/**
+		*	send to the subscribers of topic only, they share one message.
+		*	@return the number of receivers
+		*/
+		uint32_t					Publish(uint32_t topic, const std::string& data, const std::string& userdata, uint8_t type);
+
 		uint32_t					CreateCache(const std::string& data);
 
 		void							Exit();
@@ -48,23 +139,88 @@ namespace moon
 
 		virtual void					Destory() {}
 
+		/**
+		*	replace the module's code in place, called in the Worker thread between messages,
+		*	so queued messages stay in the mailbox and are handled by the new code.
+		*	@return false if not supported or failed, the module keeps running the old code
+		*/
+		virtual bool					Reload() { return false; }
+
 		virtual void					OnMessage(ModuleID sender, const std::string&data, const std::string& userdata, uint64_t rpcID, uint8_t type) {}
 
+		/**
+		*	called for every Message. the default implementation copies the payload and calls OnMessage,
+		*	override it to read the Message without copying
+		*/
+		virtual void					OnMessageEx(const MessagePtr& msg);
+
+		/**
+		*	called with the messages taken in one scheduling turn when SetMessageBatch(n > 1),
+		*	the default implementation calls OnMessageEx for each
+		*/
+		virtual void					OnMessageBatch(const std::vector<MessagePtr>& msgs);
+
 		size_t							GetMQSize();
 		void								SetID(ModuleID moduleID);
 		void								SetName(const std::string& name);
 		void								SetManager(ModuleManager* mgr);
+		ModuleManager*				GetManager();
+		/**
+		*	the Worker currently running this module, changes when the module migrates. thread safe
+		*/
+		void								SetWorker(Worker* w);
+		Worker*							GetWorker();
+
+		/**
+		*	a pinned module never migrates to another Worker, set for modules placed by a
+		*	worker, dedicated or colocate hint in the config. thread safe
+		*/
+		void								SetPinned(bool v);
+		bool								IsPinned();
 
 		void								SetOK(bool v);
 		bool								IsOk();
 
-		void								PushMessage(const MessagePtr& msg);
 		/**
-		*	check Message queue,handle a Message,if Message queue size >0,return true else return false
+		*	push a Message to the mailbox of its priority, thread safe.
+		*	@return true if the module was idle and must be added to the Worker's ready queue
+		*/
+		bool								PushMessage(const MessagePtr& msg);
+		/**
+		*	check Message queue,handle a Message,if Message queue size >0,return true else return false.
+		*	high priority messages go first, but a normal message is handled after every
+		*	HIGH_PRIORITY_BURST high priority ones so the normal lane never starves
 		*	@return
 		*/
 		bool								PeekMessage();
+
+		/**
+		*	time out the expired requests, called by the Worker at the deadline registered with Worker::ScheduleRPCTimeout.
+		*	@return the next deadline to register, 0 if none
+		*/
+		int64_t							CheckRPCTimeout(int64_t deadline, int64_t now);
+
+		/**
+		*	the deadline this module expects its Worker to call CheckRPCTimeout at, 0 if none
+		*/
+		int64_t							GetRPCWakeup();
 	private:
+		/**
+		*	match a reply with its request.
+		*	@return false if the reply is late and must be dropped
+		*/
+		bool								CompleteRPC(const MessagePtr& msg);
+
+		/**
+		*	call Update, timed when statistics are enabled
+		*/
+		void								RunUpdate(uint32_t interval);
+
+		/**
+		*	handler and Update time in ns, used to sort ModuleManager::DumpModuleStats
+		*/
+		uint64_t							GetBusyTime();
+
 		struct  ModuleImp;
 		std::shared_ptr<ModuleImp>		m_ModuleImp;
 	};
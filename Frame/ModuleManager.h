@@ -10,127 +10,414 @@ Licensed under the MIT License <http://opensource.org/licenses/MIT>.
 #pragma once
 #include "MacroDefine.h"
 #include "Common/noncopyable.hpp"
+#include <shared_mutex>
 
 namespace moon
 {
 	DECLARE_SHARED_PTR(Worker)
 	DECLARE_SHARED_PTR(Module)
 	DECLARE_SHARED_PTR(MemoryStream)
+	DECLARE_SHARED_PTR(Message)
+	DECLARE_SHARED_PTR(Cluster)
 
-	//Module ࣬ModuleĴȣƳ
+	//Module 管理类，负责Module的创建，调度，移除
 	class ModuleManager:public noncopyable
 	{
+		friend class Worker;
 	public:
 		ModuleManager();
 		~ModuleManager();
 
 		/**
-		* ʼ
-		* @config ʼַ key-valueʽ : machine_id:1;worker_num:2;
-		*	machine_id Ĭֵ0 worker_num߳Ŀ Ĭֵ 1
+		* 初始化
+		* @config 初始化字符串 key-value形式 : machine_id:1;worker_num:2;migrate_threshold:4;module_budget:64;turn_budget:10;module_stats:0;trace_sample:0;
+		*	machine_id 默认值是0， worker_num（工作者线程数目） 默认值是 1
+		*	migrate_threshold 见 SetMigrateThreshold, 默认值是 0, 不迁移
+		*	module_budget turn_budget 见 SetTurnBudget, 默认值是 64 和 10
+		*	module_stats 见 SetModuleStats, 默认值是 0
+		*	trace_sample 见 SetTraceSample, 默认值是 0
 		*/
 		void			Init(const std::string& config);
 
 		/**
-		* Ϊ˿ ModuleͨѶ MachineID,ֲͬmachine,255
-		* MachineID ᱣ ModuleIDĸ8λ
+		* 为了跨进程 Module通讯 设置MachineID,用于区分不同machine,最多可以有255个
+		* MachineID 会保存在 ModuleID的高8位
 		*
-		* @return ʼʱõmachine_id, 0
+		* @return 初始化时所配置的machine_id,或者 0
 		*/
 		uint8_t		GetMachineID();
 
 		/**
-		* Module
+		* 创建Module
 		*
-		* @config ModuleãᴫݸModule::Init
+		* @config 创建Module所需的配置，会传递给Module::Init。 以下可选的 key 决定 Module 放在哪个 Worker :
+		*	worker:N 放在第 N 个 Worker
+		*	dedicated:true 独占一个 Worker, 这个 Worker 不再参与轮询分配和迁移。 需要一个还没有 Module 的 Worker,
+		*		并且至少要留下一个普通 Worker, 所以专用 Module 应该最先创建
+		*	colocate:name 和名字(注册的名字或者 Module 名字)为 name 的 Module 放在同一个 Worker, 不能放到专用 Worker
+		*	使用了这些 key 的 Module 不会被迁移(见 Module::SetPinned), 配置无效时输出警告并使用轮询分配
 		*/
 		template<typename TModule>
 		void			CreateModule(const std::string& config);
 
 		/**
-		* IDƳModule
+		* 根据ID移除Module
 		*
 		* @moduleID 
 		*/
 		void			RemoveModule(ModuleID moduleID);
 
 		/**
-		* ĳModuleϢ
+		* 重新加载Module的代码, 在Module所在的工作线程中两次消息处理之间执行,
+		* 邮箱中的消息保留给新的代码处理。 这个函数是线程安全的
 		*
-		* @sender id
-		* @receiver id
-		* @msg Ϣ
+		* @moduleID
+		*/
+		void			ReloadModule(ModuleID moduleID);
+
+		/**
+		* 获取重新加载的次数和最近一次重新加载用的时间(微秒)
+		*/
+		uint64_t		GetReloadCount();
+
+		uint64_t		GetLastReloadTime();
+
+		/**
+		* 向某个Module发送消息
+		*
+		* @sender 发送者id
+		* @receiver 接收者id
+		* @msg 消息内容
 		*/
 		void			Send(ModuleID sender, ModuleID receiver,const std::string& data, const std::string& userdata, uint64_t rpcID,uint8_t type);
 
 		void			SendEx(ModuleID sender, ModuleID receiver, const MemoryStreamPtr& data,const std::string& userdata,uint64_t rpcID, uint8_t type);
 
 		/**
-		* Module˷ߣ㲥Ϣ
+		* 向所有Module（除了发送者）广播消息
 		*
-		* @sender	id
-		* @msg		Ϣ
+		* @sender	发送者id
+		* @msg		消息内容
 		*/
 		void			Broadcast(ModuleID sender, const std::string& data,const std::string& userdata,uint8_t type);
 
 		/**
-		* Worker߳
+		* 订阅主题, 之后发布到这个主题的消息会投递给 Module。 Module 移除时自动取消订阅。
+		* 主题只在本 machine 内有效, 这个函数是线程安全的
+		*
+		* @topic 主题ID, 由使用者定义
+		* @moduleID
+		*/
+		void			Subscribe(uint32_t topic, ModuleID moduleID);
+
+		void			Unsubscribe(uint32_t topic, ModuleID moduleID);
+
+		/**
+		* 向主题的所有订阅者（除了发送者）发布消息, 所有订阅者共享同一个消息对象。
+		* 没有订阅者时不创建消息
+		*
+		* @sender	发送者id
+		* @topic		主题ID
+		* @return 收到消息的 Module 数目
+		*/
+		uint32_t		Publish(ModuleID sender, uint32_t topic, const std::string& data, const std::string& userdata, uint8_t type);
+
+		/**
+		* 投递已经构造好的消息。接收者的 MachineID 与本 machine 不同时，
+		* 消息会通过 Cluster 转发到接收者所在的 machine
+		*
+		* @msg
+		*/
+		void			DispatchMessage(const MessagePtr& msg);
+
+		/**
+		* 监听其它 machine 的 Cluster 连接，需要在 Run 之前调用
+		*
+		* @ip
+		* @port
+		*/
+		void			ListenCluster(const std::string& ip, const std::string& port);
+
+		/**
+		* 添加远程 machine，发送给该 machine 上 Module 的消息会通过 Cluster 转发。需要在 Run 之前调用
+		*
+		* @machineID 远程 machine 的 machine_id
+		* @ip
+		* @port 远程 machine ListenCluster 的端口
+		*/
+		void			AddClusterPeer(uint8_t machineID, const std::string& ip, const std::string& port);
+
+		/**
+		* 把名字绑定到 Module, 名字已经绑定时重新绑定, 并通知关注这个名字的 Module。
+		* 名字只在本 machine 内有效, Module 移除时自动解除绑定。 这个函数是线程安全的
+		*
+		* @name
+		* @moduleID
+		*/
+		void			RegisterName(const std::string& name, ModuleID moduleID);
+
+		/**
+		* 解除名字的绑定, 名字当前没有绑定到 moduleID 时什么也不做
+		*
+		* @name
+		* @moduleID
+		*/
+		void			UnregisterName(const std::string& name, ModuleID moduleID);
+
+		/**
+		* 根据名字查找 Module。 读取线程本地缓存的名字表快照, 名字表没有变化时不加锁，
+		* 可以在任意线程中频繁调用
+		*
+		* @name
+		* @return 名字绑定的 Module ID, 0 表示没有绑定
+		*/
+		ModuleID	GetModuleByName(const std::string& name);
+
+		/**
+		* 关注名字的绑定, 之后名字每次重新绑定或者解除绑定, watcher 都会收到一条高优先级的
+		* ModuleNameChanged 消息。 这个函数是线程安全的
+		*
+		* @name
+		* @watcher 接收通知的 Module
+		* @return 名字当前绑定的 Module ID, 0 表示没有绑定
+		*/
+		ModuleID	WatchName(const std::string& name, ModuleID watcher);
+
+		void			UnwatchName(const std::string& name, ModuleID watcher);
+
+		/**
+		* 设置 Module 迁移的阈值。空闲的 Worker 会从等待处理的 Module 数目
+		* 不小于这个值的 Worker 中取走一个 Module, 0 表示不迁移
+		*
+		* @threshold
+		*/
+		void			SetMigrateThreshold(uint32_t threshold);
+
+		uint32_t		GetMigrateThreshold();
+
+		/**
+		* 获取 Module 迁移的次数
+		*/
+		uint64_t		GetMigrateCount();
+
+		/**
+		* 设置 Worker 每一轮消息处理的预算。 预算用完后 Worker 先处理定时器和 Update,
+		* 剩下的消息在下一轮处理, 避免一个 Module 收到大量消息时其它 Module 得不到处理
+		*
+		* @moduleBudget 每个 Module 每一轮最多处理的消息数(批量处理时一批算一次), 0 表示不限制
+		* @timeBudget 每一轮最多处理消息的时间 ms, 0 表示不限制
+		*/
+		void			SetTurnBudget(uint32_t moduleBudget, uint32_t timeBudget);
+
+		uint32_t		GetModuleBudget();
+
+		uint32_t		GetTimeBudget();
+
+		/**
+		* 获取 Worker 因为预算用完让出的次数
+		*/
+		uint64_t		GetYieldCount();
+
+		/**
+		* 记录一次阻塞工作线程的 Sleep, 这个函数是线程安全的
+		*
+		* @ms 阻塞的时间
+		*/
+		void			AddBlockingSleep(uint32_t ms);
+
+		/**
+		* 获取阻塞工作线程的 Sleep 次数和总时间(ms)
+		*/
+		uint64_t		GetBlockingSleepCount();
+
+		uint64_t		GetBlockingSleepTime();
+
+		/**
+		* 开启或关闭 Module 的运行统计(消息数, 字节数, 邮箱长度最大值, 消息处理和 Update 的耗时)。
+		* 关闭时不统计, 每条消息只多一次判断
+		*
+		* @enable
+		*/
+		void			SetModuleStats(bool enable);
+
+		bool			IsModuleStatsEnabled();
+
+		/**
+		* 获取 Module 的运行统计, 见 Module::GetStats。 这个函数是线程安全的
+		*
+		* @moduleID
+		*/
+		std::string	GetModuleStats(ModuleID moduleID);
+
+		/**
+		* 输出所有 Module 的运行统计到日志, 每个 Module 一行, 按消息处理和 Update 的总耗时排序
+		*
+		* @return 输出的内容
+		*/
+		std::string	DumpModuleStats();
+
+		/**
+		* 设置消息流程追踪的采样率, 每个网络线程每 n 条网络消息追踪一条, 0 表示关闭。
+		* 追踪的消息经过 Session 接收, Worker 分发, 消息处理, Module 发送, socket 写入时记录事件, 见 Tracer
+		*
+		* @n
+		*/
+		void			SetTraceSample(uint32_t n);
+
+		uint32_t		GetTraceSample();
+
+		/**
+		* 把所有线程记录的追踪事件写入文件, 格式是 Chrome trace event JSON
+		*
+		* @path
+		* @return 写入是否成功
+		*/
+		bool			DumpTrace(const std::string& path);
+
+		/**
+		* 输出每个 Worker 上的 Module 到日志, 每个 Worker 一行, 专用 Worker 会标记出来, 不会迁移的 Module 后面有 *
+		*
+		* @return 输出的内容
+		*/
+		std::string	DumpPlacement();
+
+		/**
+		* 启动所有Worker线程
 		*
 		*/
 		void			Run();
 
 		/**
-		* رWorker߳
+		* 关闭所有Worker线程
 		*
 		*/
 		void			Stop();
 
 	private:
+		using NameTable = std::unordered_map<std::string, ModuleID>;
+
+		enum class EPlacement :uint8_t
+		{
+			Any,//轮询分配, 可以迁移
+			Pinned,//指定了 Worker, 不迁移
+			Dedicated,//独占 Worker
+		};
+
 		/**
-		* ѯȡWorker ID
+		* 轮询获取Worker ID, 跳过专用 Worker
 		*/
 		uint8_t		GetNextWorkerID();
 
 		/**
-		* Moduleӵ Worker
+		* 根据 Module 配置中的 worker, dedicated, colocate 选择 Worker, 见 CreateModule
+		* 专用 Worker 在选中时就被预留, 并发的 CreateModule 和迁移都不会再把 Module 放到这个 Worker
+		* @config
+		* @placement 输出放置方式
+		* @colocate 输出 colocate 的目标 Module, 放置时才固定目标
+		*/
+		uint8_t		SelectWorker(const std::string& config, EPlacement& placement, ModuleID& colocate);
+
+		/**
+		* 把Module添加到 Worker
 		* @workerid 
 		* @m
+		* @placement 
+		* @colocate 不为 0 时放到这个 Module 所在的 Worker, 并固定这个 Module
 		*/
-		void			AddModuleToWorker(uint8_t workerid,const ModulePtr& m);
+		void			AddModuleToWorker(uint8_t workerid,const ModulePtr& m, EPlacement placement = EPlacement::Any, ModuleID colocate = 0);
 
 		/**
-		* Module ID ȡڵ workerID
+		* 释放 SelectWorker 预留的专用 Worker, Module 初始化失败或者专用 Worker 上的 Module 移除后调用
+		*/
+		void			CancelPlacement(uint8_t workerid, EPlacement placement);
+
+		/**
+		* 根据Module ID 查找 Module, 这个函数是线程安全的
 		* @module id
 		*/
-		uint8_t		GetWorkerID(ModuleID id);
+		ModulePtr	FindModule(ModuleID id);
+
+		/**
+		* 从目录中删除 Module, 同时解除 Module 绑定的名字和关注
+		*/
+		void			EraseModule(ModuleID id);
+
+		/**
+		* 获取 Cluster, 不存在则创建
+		*/
+		const ClusterPtr& GetCluster();
+
+		/**
+		* 替换名字表快照, 需要持有 m_ModuleNamesLock
+		*/
+		void			PublishNames(const std::shared_ptr<const NameTable>& names);
+
+		/**
+		* 通知关注者名字重新绑定, 需要持有 m_ModuleNamesLock, 关注者按绑定的顺序收到通知
+		*/
+		void			NotifyName(const std::string& name, ModuleID moduleID, const std::vector<ModuleID>& watchers);
 
 	private:
 		std::atomic<uint8_t>													m_nextWorker;
-		std::atomic<uint16_t>													m_IncreaseModuleID;
+		std::atomic<uint32_t>													m_IncreaseModuleID;
+		std::atomic<uint32_t>													m_MigrateThreshold;
+		std::atomic<uint64_t>													m_MigrateCount;
+		std::atomic<uint32_t>													m_ModuleBudget;
+		std::atomic<uint32_t>													m_TimeBudget;
+		std::atomic<uint64_t>													m_YieldCount;
+		std::atomic<uint64_t>													m_BlockingSleepCount;
+		std::atomic<uint64_t>													m_BlockingSleepTime;
+		std::atomic<uint64_t>													m_ReloadCount;
+		std::atomic<uint64_t>													m_LastReloadTime;
+		std::atomic<bool>														m_ModuleStats;
 		
 		std::vector<WorkerPtr>												m_Workers;
+
+		//选择专用 Worker, 把 Module 加入 Worker 和迁移 Module 时持有, 保证专用 Worker 只有一个 Module
+		std::mutex																	m_PlacementLock;
+
+		//Module ID 到 Module 的目录, Module 当前所在的 Worker 由 Module 自己记录
+		std::shared_timed_mutex												m_DirectoryLock;
+		std::unordered_map<ModuleID, ModulePtr>				m_Directory;
 		uint8_t																			m_MachineID;
 
+		//名字表, 修改时复制一份新的快照替换(写时复制), 读取者通过版本号判断本地缓存的快照是否过期
 		std::mutex																	m_ModuleNamesLock;
-		std::vector<std::string>												m_ModuleNames;
+		std::shared_ptr<const NameTable>									m_ModuleNames;
+		std::atomic<uint64_t>													m_NameVersion;
+		std::unordered_map<std::string, std::vector<ModuleID>>	m_NameWatchers;
+
+		//主题到订阅者的表, 订阅者列表写时复制, 发布时只在取出列表时持有读锁
+		std::shared_timed_mutex												m_TopicsLock;
+		std::unordered_map<uint32_t, std::shared_ptr<const std::vector<ModuleID>>>	m_Topics;
+
+		ClusterPtr																	m_Cluster;
 	};
 
 	template<typename TModule>
 	void ModuleManager::CreateModule(const std::string& config)
 	{
-		uint16_t	incID = m_IncreaseModuleID.fetch_add(1);
-		uint8_t		workerID = GetNextWorkerID();
+		uint32_t	incID = m_IncreaseModuleID.fetch_add(1) & 0xFFFFFF;
+		EPlacement placement = EPlacement::Any;
+		ModuleID	colocate = 0;
+		uint8_t		workerID = SelectWorker(config, placement, colocate);
 		uint32_t	moduleID = 0;
-		moduleID |= (uint32_t(m_MachineID) << 24);//Module ID  32-25 bitmachineID
-		moduleID |= (uint32_t(workerID) << 16);//Module ID  24-17 bitworkerID
+		moduleID |= (uint32_t(m_MachineID) << 24);//Module ID 的 32-25 bit保存machineID
+		//Module 可能在 Worker 之间迁移, 所在的 Worker 通过 m_Directory 查找
 		moduleID |= (incID);
 
 		auto module = std::make_shared<TModule>();
 		module->SetID(moduleID);
 		module->SetManager(this);
 
-		if(module->Init(config))
-		AddModuleToWorker(workerID, module);
+		if (module->Init(config))
+		{
+			AddModuleToWorker(workerID, module, placement, colocate);
+		}
+		else
+		{
+			CancelPlacement(workerID, placement);
+		}
 	}
 };
 
@@ -5,6 +5,8 @@ namespace moon
 {
 	class Message;
 
+	DECLARE_SHARED_PTR(Message)
+
 	class Network
 	{
 	public:
@@ -13,14 +15,14 @@ namespace moon
 		~Network();
 
 		/**
-		* ʼ
+		* 初始化网络
 		*
-		* @threadNum ߳
+		* @threadNum 网络线程数
 		*/
 		void				InitNet(int threadNum);
 
 		/**
-		* ĵַ
+		* 网络监听的地址
 		*
 		* @ip
 		* @port
@@ -28,7 +30,7 @@ namespace moon
 		bool				Listen(const std::string& ip, const std::string& port);
 
 		/**
-		* 첽ӷӶ
+		* 异步连接服务器（可连接多个）
 		*
 		* @ip
 		* @port
@@ -36,38 +38,96 @@ namespace moon
 		void				Connect(const std::string& ip, const std::string& port);
 
 		/**
-		* ͬӷ
+		* 同步连接服务器
 		*
 		* @ip
 		* @port
-		* @return id
+		* @return 服务器连接id
 		*/
 		SessionID		SyncConnect(const std::string& ip, const std::string& port);
 
 		/**
-		* ĳӷϢ
+		* 向某个链接发送消息
 		*
 		* @sessionID
+		* @priority 发送优先级 ESendPriority, Bulk 的消息分片发送，不会阻塞 Urgent 的消息
 		*/
-		void				Send(SessionID sessionID,const std::string& data);
+		void				Send(SessionID sessionID,const std::string& data, uint8_t priority);
 
 		/**
-		* ǿƹرһ
+		* 发送 Message 的数据，数据保存在 MemoryStream 中时直接共享，不复制
+		* 用于转发收到的大数据
+		*
+		* @sessionID
+		* @priority 发送优先级 ESendPriority
+		*/
+		void				SendMessage(SessionID sessionID, const MessagePtr& msg, uint8_t priority);
+
+		/**
+		* 强制关闭一个网络连接
 		*
 		* @sessionID
 		*/
 		void				Close(SessionID sessionID);
 
 		/**
-		* Sessionĳʱ
-		* @timeout ʱʱ λ s
+		* 设置Session的超时检测
+		* @timeout 超时时间 ，单位 s
 		*/
 		void				SetTimeout(uint32_t timeout);
 
 		/**
-		* Ϣص
+		* 设置优雅关闭的超时时间，0 表示 Destory 时立即关闭所有连接
+		* Destory 时停止接受新连接，通知消息处理回掉（EMessageType::NetworkDrain），
+		* 然后发送完所有连接的发送队列并关闭写端，最多等待 timeout 毫秒。
+		* 等待在单独的线程中进行，Destory 立即返回，见 WaitDrain
+		* @timeout 超时时间 ，单位 ms
+		*/
+		void				SetDrainTimeout(uint32_t timeout);
+
+		/**
+		* 等待所有 Network 的优雅关闭结束，ModuleManager::Stop 返回前调用
+		*/
+		static void		WaitDrain();
+
+		/**
+		* 设置连接准入控制，各项为 0 表示不限制
+		* @maxSessions 最大连接数
+		* @connectRate 单个IP每秒最多建立的连接数
+		* @maxBacklog 未处理的网络消息数上限
+		* @pauseAccept 超过连接数或积压上限时 true:暂停accept false:accept后发送拒绝原因并关闭
+		*/
+		void				SetAdmission(uint32_t maxSessions, uint32_t connectRate, uint32_t maxBacklog, bool pauseAccept);
+
+		/**
+		* 设置每个连接的接收频率限制(令牌桶)，各项为 0 表示不限制
+		* @framesPerSecond 每秒最多接收的消息数
+		* @bytesPerSecond 每秒最多接收的字节数
+		* @action 超过限制时的处理 "pause":暂停读取 "drop":丢弃消息 "close":关闭连接
+		*/
+		void				SetRateLimit(uint32_t framesPerSecond, uint32_t bytesPerSecond, const std::string& action);
+
+		/**
+		* 获取连接准入统计, 格式 "sessions:1;rejected:0;sessionlimit:0;connectrate:0;backlog:0;paused:0;"
+		*/
+		std::string		GetAdmissionStats();
+
+		/**
+		* 网络消息处理回掉
 		*/
 		void				SetHandler(const std::function<void(uint32_t, const std::string&, uint8_t)>&);
+
+		/**
+		* 网络消息处理回掉，直接传递 Message, 不复制数据。 设置后代替 SetHandler 的回掉
+		*/
+		void				SetBufferHandler(const std::function<void(uint32_t, const MessagePtr&, uint8_t)>&);
+
+		/**
+		* 获取当前的回掉, 重新加载 Lua Module 失败时用于恢复
+		*/
+		std::function<void(uint32_t, const std::string&, uint8_t)>		GetHandler();
+
+		std::function<void(uint32_t, const MessagePtr&, uint8_t)>		GetBufferHandler();
 	public:
 		void				Start();
 
@@ -9,6 +9,7 @@ Licensed under the MIT License <http://opensource.org/licenses/MIT>.
 
 #pragma once
 #include <memory>
+#include "Common/MemoryPool.hpp"
 
 template<typename TObject>
 class ObjectCreateHelper
@@ -19,7 +20,8 @@ public:
 	template<typename... Args>
 	static TObjectPtr Create(Args&&... args)
 	{
-		return std::make_shared<TObject>(std::forward<Args>(args)...);
+		//object and reference count are allocated from MemoryPool
+		return std::allocate_shared<TObject>(moon::PoolAllocator<TObject>(), std::forward<Args>(args)...);
 	}
 };
 
@@ -4,6 +4,9 @@
 #include "Common/TupleUtils.hpp"
 #include "Common/Path.hpp"
 #include "Common/Timer/TimerPool.h"
+#include "Message.h"
+#include "ModuleManager.h"
+#include "Network.h"
 
 #include "Detail/Log/Log.h"
 #include "sol.hpp"
@@ -18,6 +21,12 @@ struct ModuleLua::ModuleLuaImp
 	sol::function			Update;
 	sol::function			Destory;
 	sol::function			OnMessage;
+	sol::function			OnMessageBatch;
+	//reused between turns, 5 values per message
+	sol::table				Batch;
+	bool						MessageBuffer = false;
+	//warned about a blocking Sleep
+	bool						SleepWarned = false;
 	std::string				Config;
 	std::unordered_map<std::string, std::string> KvConfig;
 	TimerPool			timerPool;
@@ -65,13 +74,45 @@ bool ModuleLua::Init(const std::string& config)
 
 void ModuleLua::Start()
 {
-	sol::state& lua = m_ModuleLuaImp->lua;
+	auto& conf = m_ModuleLuaImp->KvConfig;
+	if (!contains_key(conf, "luafile"))
+	{
+		CONSOLE_ERROR("Lua moudle [name: %s] Init failed, does not have luafile",conf["name"].data());
+		SetOK(false);
+		Exit();
+		return;
+	}
 
-	lua.open_libraries(sol::lib::os,sol::lib::base, sol::lib::package, sol::lib::math, sol::lib::io, sol::lib::table, sol::lib::string,sol::lib::debug);
+	try
+	{
+		if (!Load(*m_ModuleLuaImp))
+		{
+			SetOK(false);
+			Exit();
+			return;
+		}
+		m_ModuleLuaImp->Init(m_ModuleLuaImp->Config);
+		m_ModuleLuaImp->Start();
+	}
+	catch (sol::error& e)
+	{
+		SetOK(false);
+		Exit();
+		CONSOLE_ERROR("ModuleLua OnEnter: %s\r\n", e.what());
+		CONSOLE_DEBUG("Traceback: %s", Traceback(m_ModuleLuaImp->lua.lua_state()).data());
+	}
+}
+
+bool ModuleLua::Load(ModuleLuaImp& imp)
+{
+	sol::state& lua = imp.lua;
+
+	lua.open_libraries(sol::lib::os,sol::lib::base, sol::lib::package, sol::lib::math, sol::lib::io, sol::lib::table, sol::lib::string,sol::lib::debug,sol::lib::coroutine);
 	MoonNetLuaBind luaBind(lua);
 	luaBind.BindTime()
 		.BindThreadSleep()
 		.BindEMessageType()
+		.BindMessage()
 		.BindNetwork()
 		.BindModule()
 		.BindLog()
@@ -79,110 +120,372 @@ void ModuleLua::Start()
 		.BindPath()
 		.BindTimer();
 
-
-	auto& conf = m_ModuleLuaImp->KvConfig;
-	if (!contains_key(conf, "luafile"))
-	{
-		CONSOLE_ERROR("Lua moudle [name: %s] Init failed, does not have luafile",conf["name"].data());
-		SetOK(false);
-		Exit();
-		return;
-	}
-	{
-		try
+	//Sleep outside a coroutine or with update disabled can only block the Worker, see Sleep in the glue script
+	lua.set_function("ThreadSleep", [this](uint32_t ms) {
+		if (!m_ModuleLuaImp->SleepWarned)
 		{
-			auto& lua = m_ModuleLuaImp->lua;
+			m_ModuleLuaImp->SleepWarned = true;
+			CONSOLE_WARN("Module [%s:%u] Sleep(%u) blocks its Worker, call it in OnMessage or Async with update enabled", GetName().c_str(), GetID(), ms);
+		}
+		GetManager()->AddBlockingSleep(ms);
+		thread_sleep(ms);
+	});
 
 #if TARGET_PLATFORM == PLATFORM_WINDOWS
-			lua.script("package.cpath = './Lib/?.dll;'");
+	lua.script("package.cpath = './Lib/?.dll;'");
 #else
-			lua.script("package.cpath = './Lib/?.so;'");
+	lua.script("package.cpath = './Lib/?.so;'");
 #endif
 
-			auto& conf = m_ModuleLuaImp->KvConfig;
-			lua.set("nativeModule", this);
-			lua.set("timerPool", std::ref(m_ModuleLuaImp->timerPool));
-			sol::object obj = lua.require_file(conf["name"], conf["luafile"]);
-			if (!obj.valid())
-			{
-				CONSOLE_ERROR("Lua moudle [name: %s] Init failed,luafile[%s] load failed", conf["name"].data(), conf["luafile"].data());
-				CONSOLE_DEBUG("Traceback: %s", Traceback(m_ModuleLuaImp->lua.lua_state()).data());
-				SetOK(false);
-				Exit();
-				return;
-			}
+	auto& conf = imp.KvConfig;
+	lua.set("nativeModule", this);
+	lua.set("timerPool", std::ref(imp.timerPool));
+	sol::object obj = lua.require_file(conf["name"], conf["luafile"]);
+	if (!obj.valid())
+	{
+		CONSOLE_ERROR("Lua moudle [name: %s] Init failed,luafile[%s] load failed", conf["name"].data(), conf["luafile"].data());
+		CONSOLE_DEBUG("Traceback: %s", Traceback(lua.lua_state()).data());
+		return false;
+	}
 
-			std::string newmodule = string_utils::format("thisModule = %s.new()", conf["name"].data());
-			lua.script(newmodule);
-			lua.script(R"(
-			function Init(config)
-				return thisModule:Init(config)
+	std::string newmodule = string_utils::format("thisModule = %s.new()", conf["name"].data());
+	lua.script(newmodule);
+	lua.script(R"(
+		function Init(config)
+			return thisModule:Init(config)
+		end
+
+		function Start()
+			return thisModule:Start()
+		end
+
+		function Update(interval)
+			return thisModule:Update(interval)
+		end
+
+		function  Destory()
+			return thisModule:Destory()
+		end
+
+		-- finished coroutines wait here for the next call, see Module:Await and Module:Sleep
+		local pool, poolSize = {}, 0
+		local POOL_MAX = 64
+
+		local function Routine(f, a, b, c, d, e, g)
+			local co = coroutine.running()
+			while true do
+				f(a, b, c, d, e, g)
+				if poolSize == POOL_MAX then
+					return
+				end
+				poolSize = poolSize + 1
+				pool[poolSize] = co
+				f, a, b, c, d, e, g = coroutine.yield()
 			end
-
-			function Start()
-				return thisModule:Start()
+		end
+
+		-- call f with up to 6 arguments in a pooled coroutine, f may yield
+		function Async(f, a, b, c, d, e, g)
+			local co
+			if poolSize > 0 then
+				co = pool[poolSize]
+				pool[poolSize] = nil
+				poolSize = poolSize - 1
+			else
+				co = coroutine.create(Routine)
 			end
-
-			function Update(interval)
-				return thisModule:Update(interval)
+			local ok, err = coroutine.resume(co, f, a, b, c, d, e, g)
+			if not ok then
+				error(debug.traceback(co, err), 0)
 			end
-
-			function  Destory()
-				return thisModule:Destory()
+		end
+
+		-- in OnMessage or Async only the calling coroutine sleeps, other messages and modules keep running
+		function Sleep(ms)
+			local _, main = coroutine.running()
+			if main then
+				ThreadSleep(ms)
+			else
+				thisModule:Sleep(ms)
 			end
+		end
+
+		-- Reload: the old state returns the state to keep, the new module receives a copy of it
+		function ReloadSave()
+			return thisModule:_ReloadSave()
+		end
+
+		function Reload(state)
+			return thisModule:_Reload(state)
+		end
+
+		-- called on the old state once the new module took over
+		function ReloadCommit()
+			return thisModule:_ReloadCommit()
+		end
+
+		function  OnMessage(sender,data,userData,rpcID,msgType)
+			Async(thisModule.OnMessage,thisModule,sender,data,userData,rpcID,msgType)
+		end
+
+		-- batch holds 5 values per message: sender,data,userData,rpcID,msgType
+		local batch, count, index
+		-- the coroutine running BatchLoop, replaced when a handler yields
+		local runner
+
+		-- one coroutine handles the batch until a handler yields, then another one continues
+		local function BatchLoop()
+			local co = coroutine.running()
+			runner = co
+			local m = thisModule
+			local f = m.OnMessage
+			local b = batch
+			while index <= count do
+				local k = index * 5 - 4
+				index = index + 1
+				f(m, b[k], b[k + 1], b[k + 2], b[k + 3], b[k + 4])
+				-- resumed after a yield, the rest of the batch was handled by another coroutine
+				if runner ~= co then
+					return
+				end
+			end
+		end
 
-			function  OnMessage(sender,data,userData,rpcID,msgType)
-				return thisModule:OnMessage(sender,data,userData,rpcID,msgType)
+		local function HandleBatch()
+			while index <= count do
+				Async(BatchLoop)
+			end
+		end
+
+		-- return the index of the failed message and the error, or 0
+		function OnMessageBatch(b, n)
+			batch, count, index = b, n, 1
+			local ok, err = xpcall(HandleBatch, debug.traceback)
+			batch, runner = nil, nil
+			if ok then
+				return 0, ""
 			end
-			)");
+			return index - 1, err
+		end
+		)");
+
+	imp.Init = lua["Init"];
+	imp.Start = lua["Start"];
+	imp.Update = lua["Update"];
+	imp.Destory = lua["Destory"];
+	imp.OnMessage = lua["OnMessage"];
+	imp.OnMessageBatch = lua["OnMessageBatch"];
+	imp.Batch = lua.create_table();
+
+	Assert(imp.Init.valid() && imp.Start.valid() && imp.Update.valid() && imp.Destory.valid() && imp.OnMessage.valid(), "5 functions!");
+	return true;
+}
 
-			
+void ModuleLua::Destory()
+{
+	if (!IsOk())
+		return;
 
-			m_ModuleLuaImp->Init = lua["Init"];
-			m_ModuleLuaImp->Start = lua["Start"];
-			m_ModuleLuaImp->Update = lua["Update"];
-			m_ModuleLuaImp->Destory = lua["Destory"];
-			m_ModuleLuaImp->OnMessage = lua["OnMessage"];
+	try
+	{
+		m_ModuleLuaImp->Destory();
+	}
+	catch (sol::error& e)
+	{
+		SetOK(false);
+		Exit();
+		CONSOLE_ERROR("ModuleLua OnExit: %s\r\n", e.what());
+		CONSOLE_DEBUG("Traceback: %s", Traceback(m_ModuleLuaImp->lua.lua_state()).data());
+	}
+}
 
-			Assert(m_ModuleLuaImp->Init.valid() && m_ModuleLuaImp->Start.valid() && m_ModuleLuaImp->Update.valid() && m_ModuleLuaImp->Destory.valid() && m_ModuleLuaImp->OnMessage.valid(), "5 functions!");
-			m_ModuleLuaImp->Init(m_ModuleLuaImp->Config);
-			m_ModuleLuaImp->Start();
+//Network handlers saved before a reload, restored if it fails
+using NetworkHandlers = std::tuple<std::shared_ptr<Network>, std::function<void(uint32_t, const std::string&, uint8_t)>, std::function<void(uint32_t, const MessagePtr&, uint8_t)>>;
+
+//copy boolean, number, string and table values between two lua states, other values become nil
+//and are skipped in tables. cache is a table in to, shared tables are copied only once.
+//Network objects are shared, their handlers point into the old state and are cleared
+static void CopyValue(lua_State* from, int index, lua_State* to, int cache, std::vector<NetworkHandlers>& networks)
+{
+	index = lua_absindex(from, index);
+	luaL_checkstack(from, 3, "CopyValue");
+	luaL_checkstack(to, 4, "CopyValue");
+	switch (lua_type(from, index))
+	{
+	case LUA_TBOOLEAN:
+		lua_pushboolean(to, lua_toboolean(from, index));
+		break;
+	case LUA_TNUMBER:
+		if (lua_isinteger(from, index))
+			lua_pushinteger(to, lua_tointeger(from, index));
+		else
+			lua_pushnumber(to, lua_tonumber(from, index));
+		break;
+	case LUA_TSTRING:
+	{
+		size_t len;
+		auto s = lua_tolstring(from, index, &len);
+		lua_pushlstring(to, s, len);
+		break;
+	}
+	case LUA_TTABLE:
+	{
+		auto key = lua_topointer(from, index);
+		if (lua_rawgetp(to, cache, key) != LUA_TNIL)
+			break;
+		lua_pop(to, 1);
+		lua_newtable(to);
+		lua_pushvalue(to, -1);
+		lua_rawsetp(to, cache, key);
+		lua_pushnil(from);
+		while (lua_next(from, index) != 0)
+		{
+			CopyValue(from, -2, to, cache, networks);
+			CopyValue(from, -1, to, cache, networks);
+			if (lua_isnil(to, -2) || lua_isnil(to, -1))
+				lua_pop(to, 2);
+			else
+				lua_rawset(to, -3);
+			lua_pop(from, 1);
 		}
-		catch (sol::error& e)
+		break;
+	}
+	case LUA_TUSERDATA:
+	{
+		bool isNetwork = false;
+		if (lua_getmetatable(from, index) != 0)
 		{
-			SetOK(false);
-			Exit();
-			CONSOLE_ERROR("ModuleLua OnEnter: %s\r\n", e.what());
-			CONSOLE_DEBUG("Traceback: %s", Traceback(m_ModuleLuaImp->lua.lua_state()).data());
+			isNetwork = sol::stack::stack_detail::check_metatable<sol::detail::unique_usertype<Network>>(from, lua_gettop(from));
+			if (!isNetwork)
+				lua_pop(from, 1);
+		}
+
+		if (!isNetwork)
+		{
+			lua_pushnil(to);
+			break;
 		}
+
+		auto net = sol::stack::get<std::shared_ptr<Network>>(from, index);
+		if (std::find_if(networks.begin(), networks.end(), [&net](const NetworkHandlers& v) { return std::get<0>(v) == net; }) == networks.end())
+		{
+			networks.emplace_back(net, net->GetHandler(), net->GetBufferHandler());
+			net->SetHandler(nullptr);
+			net->SetBufferHandler(nullptr);
+		}
+		sol::stack::push(to, net);
+		break;
+	}
+	default:
+		lua_pushnil(to);
+		break;
 	}
 }
 
-void ModuleLua::Destory()
+bool ModuleLua::Reload()
 {
 	if (!IsOk())
-		return;
+		return false;
+
+	auto imp = std::make_unique<ModuleLuaImp>();
+	imp->Config = m_ModuleLuaImp->Config;
+	imp->KvConfig = m_ModuleLuaImp->KvConfig;
+	imp->SleepWarned = m_ModuleLuaImp->SleepWarned;
+	//native settings the new module may change in OnReload, restored if the reload fails.
+	//SetMessageBuffer in the new state changes the current imp
+	auto buffer = m_ModuleLuaImp->MessageBuffer;
+	auto batch = GetMessageBatch();
+	auto update = IsEnableUpdate();
+	auto interval = GetUpdateInterval();
+	std::vector<NetworkHandlers> networks;
 
 	try
 	{
-		m_ModuleLuaImp->Destory();
+		if (!Load(*imp))
+			return false;
+
+		sol::function save = m_ModuleLuaImp->lua["ReloadSave"];
+		sol::object saved = save();
+
+		auto from = m_ModuleLuaImp->lua.lua_state();
+		auto to = imp->lua.lua_state();
+		lua_newtable(to);
+		saved.push();
+		CopyValue(from, -1, to, lua_gettop(to), networks);
+		lua_pop(from, 1);
+		sol::object state(to, -1);
+		lua_pop(to, 2);
+
+		//the new module is constructed but not initialized or started again
+		sol::function reload = imp->lua["Reload"];
+		reload(state);
+	}
+	catch (sol::error& e)
+	{
+		m_ModuleLuaImp->MessageBuffer = buffer;
+		SetMessageBatch(batch);
+		SetUpdateInterval(interval);
+		if (IsEnableUpdate() != update)
+		{
+			SetEnableUpdate(update);
+		}
+		for (auto& it : networks)
+		{
+			std::get<0>(it)->SetHandler(std::get<1>(it));
+			std::get<0>(it)->SetBufferHandler(std::get<2>(it));
+		}
+		CONSOLE_ERROR("ModuleLua Reload: %s\r\n", e.what());
+		CONSOLE_DEBUG("Traceback: %s", Traceback(imp->lua.lua_state()).data());
+		return false;
+	}
+
+	//nothing can be rolled back from here, pending rpcs of the old module fail with "reload"
+	try
+	{
+		sol::function commit = m_ModuleLuaImp->lua["ReloadCommit"];
+		commit();
+	}
+	catch (sol::error& e)
+	{
+		CONSOLE_ERROR("ModuleLua ReloadCommit: %s\r\n", e.what());
+	}
+
+	imp->MessageBuffer = m_ModuleLuaImp->MessageBuffer;
+	//timers and handlers sleeping in the old state are dropped with it
+	m_ModuleLuaImp.swap(imp);
+	return true;
+}
+
+void ModuleLua::OnMessage(ModuleID sender,const std::string & data, const std::string & userdata, uint64_t rpcID, uint8_t type)
+{
+	if (!IsOk())
+		return;
+	try
+	{
+		m_ModuleLuaImp->OnMessage(sender,data,userdata,rpcID,type);
 	}
 	catch (sol::error& e)
 	{
 		SetOK(false);
 		Exit();
-		CONSOLE_ERROR("ModuleLua OnExit: %s\r\n", e.what());
+		CONSOLE_ERROR("ModuleLua OnMessage: %s\r\n", e.what());
 		CONSOLE_DEBUG("Traceback: %s", Traceback(m_ModuleLuaImp->lua.lua_state()).data());
 	}
 }
 
-void ModuleLua::OnMessage(ModuleID sender,const std::string & data, const std::string & userdata, uint64_t rpcID, uint8_t type)
+void ModuleLua::OnMessageEx(const MessagePtr& msg)
 {
+	if (!m_ModuleLuaImp->MessageBuffer)
+	{
+		Module::OnMessageEx(msg);
+		return;
+	}
+
 	if (!IsOk())
 		return;
 	try
 	{
-		m_ModuleLuaImp->OnMessage(sender,data,userdata,rpcID,type);
+		m_ModuleLuaImp->OnMessage(msg->GetSender(), msg, msg->GetUserData(), msg->GetRPCID(), (uint8_t)msg->GetType());
 	}
 	catch (sol::error& e)
 	{
@@ -193,15 +496,87 @@ void ModuleLua::OnMessage(ModuleID sender,const std::string & data, const std::s
 	}
 }
 
+void ModuleLua::OnMessageBatch(const std::vector<MessagePtr>& msgs)
+{
+	if (!IsOk())
+		return;
+
+	auto L = m_ModuleLuaImp->lua.lua_state();
+	try
+	{
+		auto& batch = m_ModuleLuaImp->Batch;
+		batch.push();
+		int k = 0;
+		for (auto& msg : msgs)
+		{
+			lua_pushinteger(L, msg->GetSender());
+			lua_rawseti(L, -2, ++k);
+			if (m_ModuleLuaImp->MessageBuffer)
+			{
+				sol::stack::push(L, msg);
+			}
+			else
+			{
+				lua_pushlstring(L, (const char*)msg->Data(), msg->Size());
+			}
+			lua_rawseti(L, -2, ++k);
+			lua_pushlstring(L, (const char*)msg->UserData(), msg->UserDataSize());
+			lua_rawseti(L, -2, ++k);
+			lua_pushinteger(L, static_cast<lua_Integer>(msg->GetRPCID()));
+			lua_rawseti(L, -2, ++k);
+			lua_pushinteger(L, static_cast<lua_Integer>(msg->GetType()));
+			lua_rawseti(L, -2, ++k);
+		}
+		lua_pop(L, 1);
+
+		uint32_t failed;
+		std::string err;
+		std::tie(failed, err) = m_ModuleLuaImp->OnMessageBatch.call<uint32_t, std::string>(batch, msgs.size());
+
+		//do not keep Message objects alive until the next turn
+		if (m_ModuleLuaImp->MessageBuffer)
+		{
+			batch.push();
+			for (size_t i = 0; i < msgs.size(); i++)
+			{
+				lua_pushnil(L);
+				lua_rawseti(L, -2, static_cast<lua_Integer>(i * 5 + 2));
+			}
+			lua_pop(L, 1);
+		}
+		if (0 != failed)
+		{
+			auto& msg = msgs[failed - 1];
+			SetOK(false);
+			Exit();
+			CONSOLE_ERROR("ModuleLua OnMessage: message %u of %u in batch, sender %u type %u rpc %llu: %s\r\n"
+				, failed, (uint32_t)msgs.size(), msg->GetSender(), (uint32_t)msg->GetType(), (unsigned long long)msg->GetRPCID(), err.data());
+		}
+	}
+	catch (sol::error& e)
+	{
+		SetOK(false);
+		Exit();
+		CONSOLE_ERROR("ModuleLua OnMessageBatch: %s\r\n", e.what());
+		CONSOLE_DEBUG("Traceback: %s", Traceback(m_ModuleLuaImp->lua.lua_state()).data());
+	}
+}
+
+void ModuleLua::SetMessageBuffer(bool v)
+{
+	m_ModuleLuaImp->MessageBuffer = v;
+}
+
 void ModuleLua::Update(uint32_t interval)
 {
 	if (!IsOk())
 		return;
 
 	Module::Update(interval);
-	m_ModuleLuaImp->timerPool.Update();
 	try
 	{
+		//timer callbacks may resume coroutines of lua handlers
+		m_ModuleLuaImp->timerPool.Update();
 		m_ModuleLuaImp->Update(interval);
 	}
 	catch (sol::error& e)
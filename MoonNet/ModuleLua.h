@@ -17,8 +17,24 @@ public:
 
 	void								Destory() override;
 
+	//load the luafile again into a new lua state, Init and Start are not called again.
+	//state is handed over by OnReloadSave and OnReload in lua, see Module.lua
+	bool								Reload() override;
+
 	void								OnMessage(ModuleID sender,const std::string&data, const std::string& userdata, uint64_t rpcID, uint8_t type) override;
+
+	void								OnMessageEx(const moon::MessagePtr& msg) override;
+
+	//hand all messages of a scheduling turn to lua in one call, see Module::SetMessageBatch
+	void								OnMessageBatch(const std::vector<moon::MessagePtr>& msgs) override;
+
+	//pass the Message itself to lua OnMessage instead of a copied string
+	void								SetMessageBuffer(bool v);
 private:
 	struct ModuleLuaImp;
+
+	//create the lua state and load the luafile, Init and Start are not called
+	bool								Load(ModuleLuaImp& imp);
+
 	std::unique_ptr<ModuleLuaImp> m_ModuleLuaImp;
 };
\ No newline at end of file
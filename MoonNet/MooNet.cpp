@@ -1,4 +1,4 @@
-// EchoExample.cpp : ̨Ӧóڵ㡣
+// EchoExample.cpp : 定义控制台应用程序的入口点。
 //
 
 #include "sol.hpp"
@@ -6,12 +6,12 @@
 #include "MoonNetLuaBind.h"
 #include "Common/Path.hpp"
 
-int main()
+int main(int argc, char* argv[])
 {
 	sol::state lua;
 	try
 	{
-		lua.open_libraries(sol::lib::base, sol::lib::package, sol::lib::math, sol::lib::io, sol::lib::table, sol::lib::string, sol::lib::debug);
+		lua.open_libraries(sol::lib::os, sol::lib::base, sol::lib::package, sol::lib::math, sol::lib::io, sol::lib::table, sol::lib::string, sol::lib::debug);
 		MoonNetLuaBind luaBind(lua);
 		luaBind.BindModuleManager()
 			.BindEMessageType()
@@ -23,7 +23,8 @@ int main()
 		lua.script("package.cpath = './Lib/?.so;'");
 #endif
 
-		lua.script_file("main.lua");
+		//启动脚本，默认 main.lua
+		lua.script_file((argc > 1) ? argv[1] : "main.lua");
 	}
 	catch (sol::error& e)
 	{
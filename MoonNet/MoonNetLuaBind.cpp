@@ -12,6 +12,7 @@
 #include "Module.h"
 #include "ModuleLua.h"
 #include "Network.h"
+#include "Detail/Network/NetworkDefine.h"
 
 #include "Detail/Log/Log.h"
 
@@ -37,12 +38,27 @@ MoonNetLuaBind& MoonNetLuaBind::BindTime()
 	return *this;
 }
 
+//timer callbacks are called later from the main thread. a function passed in a coroutine
+//refers to the coroutine's lua_State, which may be suspended or dead by then
+static timer_handler MainThreadHandler(const sol::function& f)
+{
+	lua_State* L = f.lua_state();
+	lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+	lua_State* main = lua_tothread(L, -1);
+	lua_pop(L, 1);
+	f.push();
+	lua_xmove(L, main, 1);
+	sol::function mf(main, -1);
+	lua_pop(main, 1);
+	return [mf]() { mf(); };
+}
+
 MoonNetLuaBind & MoonNetLuaBind::BindTimer()
 {
 	lua.new_usertype<TimerPool>("TimerPool"
 		, sol::call_constructor, sol::no_constructor
-		, "ExpiredOnce", &TimerPool::ExpiredOnce
-		, "Repeat", &TimerPool::Repeat
+		, "ExpiredOnce", [](TimerPool& pool, int64_t duration, const sol::function& f) { return pool.ExpiredOnce(duration, MainThreadHandler(f)); }
+		, "Repeat", [](TimerPool& pool, int64_t duration, int32_t times, const sol::function& f) { return pool.Repeat(duration, times, MainThreadHandler(f)); }
 		, "Remove", &TimerPool::Remove
 		, "StopAllTimer", &TimerPool::StopAllTimer
 		, "StartAllTimer", &TimerPool::StartAllTimer
@@ -55,6 +71,7 @@ MoonNetLuaBind & MoonNetLuaBind::BindUtil()
 {
 	sol::table tb = lua.create_named_table("Util");
 	tb.set_function("HashString", [](const std::string& s) { return std::hash<std::string>()(s);});
+	tb.set_function("GetMemoryPoolStats", MemoryPool::GetStats);
 
 	return *this;
 }
@@ -106,8 +123,46 @@ MoonNetLuaBind& MoonNetLuaBind::BindEMessageType()
 		, "ModuleData", EMessageType::ModuleData
 		, "ModuleRPC",EMessageType::ModuleRPC
 		, "ToClient", EMessageType::ToClient
+		, "NetworkDrain", EMessageType::NetworkDrain
+		, "ModuleRPCTimeout", EMessageType::ModuleRPCTimeout
+		, "ModuleNameChanged", EMessageType::ModuleNameChanged
 	);
 
+	lua.new_enum("EMessagePriority"
+		, "Normal", EMessagePriority::Normal
+		, "High", EMessagePriority::High
+	);
+
+	return *this;
+}
+
+//read-only view of a Message, payload is copied to a lua string only by Bytes/ReadString.
+//positions are 1-based like lua strings
+MoonNetLuaBind& MoonNetLuaBind::BindMessage()
+{
+	lua.new_usertype<Message>("Message"
+		, sol::call_constructor, sol::no_constructor
+		, "GetSender", &Message::GetSender
+		, "GetReceiver", &Message::GetReceiver
+		, "GetUserData", &Message::GetUserData
+		, "GetRPCID", &Message::GetRPCID
+		, "GetType", [](const Message& m) { return (uint8_t)m.GetType(); }
+		, "GetPriority", [](const Message& m) { return (uint8_t)m.GetPriority(); }
+		, "Size", &Message::Size
+		, "Bytes", &Message::Bytes
+		, "ReadInt8", [](const Message& m, size_t pos) { return m.Read<int8_t>(pos - 1); }
+		, "ReadUInt8", [](const Message& m, size_t pos) { return m.Read<uint8_t>(pos - 1); }
+		, "ReadInt16", [](const Message& m, size_t pos) { return m.Read<int16_t>(pos - 1); }
+		, "ReadUInt16", [](const Message& m, size_t pos) { return m.Read<uint16_t>(pos - 1); }
+		, "ReadInt32", [](const Message& m, size_t pos) { return m.Read<int32_t>(pos - 1); }
+		, "ReadUInt32", [](const Message& m, size_t pos) { return m.Read<uint32_t>(pos - 1); }
+		, "ReadInt64", [](const Message& m, size_t pos) { return m.Read<int64_t>(pos - 1); }
+		, "ReadUInt64", [](const Message& m, size_t pos) { return m.Read<uint64_t>(pos - 1); }
+		, "ReadFloat", [](const Message& m, size_t pos) { return m.Read<float>(pos - 1); }
+		, "ReadDouble", [](const Message& m, size_t pos) { return m.Read<double>(pos - 1); }
+		, "ReadString", [](const Message& m, size_t pos, size_t len) { return m.ReadString(pos - 1, len); }
+		);
+
 	return *this;
 }
 
@@ -120,12 +175,24 @@ MoonNetLuaBind& MoonNetLuaBind::BindNetwork()
 		, "SyncConnect", &Network::SyncConnect
 		, "Connect", &Network::Connect
 		, "Send", &Network::Send
+		, "SendMessage", &Network::SendMessage
 		, "Start", &Network::Start
 		, "Update", &Network::Update
 		, "Destory", &Network::Destory
 		, "SetHandler", &Network::SetHandler
+		, "SetBufferHandler", &Network::SetBufferHandler
+		, "SetTimeout", &Network::SetTimeout
+		, "SetDrainTimeout", &Network::SetDrainTimeout
+		, "SetAdmission", &Network::SetAdmission
+		, "SetRateLimit", &Network::SetRateLimit
+		, "GetAdmissionStats", &Network::GetAdmissionStats
 		);
 
+	lua.new_enum("ESendPriority"
+		, "Urgent", ESendPriority::Urgent
+		, "Bulk", ESendPriority::Bulk
+	);
+
 	lua.set_function("CreateNetwork", []() {return std::make_shared<Network>();});
 	return *this;
 }
@@ -138,8 +205,25 @@ MoonNetLuaBind& MoonNetLuaBind::BindModule()
 		, "GetID", &ModuleLua::GetID
 		, "SetEnableUpdate", &ModuleLua::SetEnableUpdate
 		, "IsEnableUpdate", &ModuleLua::IsEnableUpdate
+		, "SetUpdateInterval", &ModuleLua::SetUpdateInterval
 		, "Send", &ModuleLua::Send
+		, "Forward", &ModuleLua::Forward
+		, "SetMessageBuffer", &ModuleLua::SetMessageBuffer
+		, "SetMessageBatch", &ModuleLua::SetMessageBatch
+		, "SendRPC", &ModuleLua::SendRPC
+		, "CancelRPC", &ModuleLua::CancelRPC
+		, "GetPendingRPC", &ModuleLua::GetPendingRPC
+		, "GetRPCStats", &ModuleLua::GetRPCStats
+		, "GetStats", &ModuleLua::GetStats
+		, "RegisterName", &ModuleLua::RegisterName
+		, "UnregisterName", &ModuleLua::UnregisterName
+		, "GetModuleByName", &ModuleLua::GetModuleByName
+		, "WatchName", &ModuleLua::WatchName
+		, "UnwatchName", &ModuleLua::UnwatchName
 		, "Broadcast", &ModuleLua::Broadcast
+		, "Subscribe", &ModuleLua::Subscribe
+		, "Unsubscribe", &ModuleLua::Unsubscribe
+		, "Publish", &ModuleLua::Publish
 		, "Exit", &ModuleLua::Exit
 		);
 	return *this;
@@ -153,8 +237,29 @@ MoonNetLuaBind& MoonNetLuaBind::BindModuleManager()
 		, "GetMachineID", &ModuleManager::GetMachineID
 		, "CreateModule", &ModuleManager::CreateModule<ModuleLua>
 		, "RemoveModule", &ModuleManager::RemoveModule
+		, "ReloadModule", &ModuleManager::ReloadModule
+		, "GetReloadCount", &ModuleManager::GetReloadCount
+		, "GetLastReloadTime", &ModuleManager::GetLastReloadTime
 		, "Send", &ModuleManager::Send
 		, "Broadcast", &ModuleManager::Broadcast
+		, "Publish", &ModuleManager::Publish
+		, "ListenCluster", &ModuleManager::ListenCluster
+		, "AddClusterPeer", &ModuleManager::AddClusterPeer
+		, "RegisterName", &ModuleManager::RegisterName
+		, "UnregisterName", &ModuleManager::UnregisterName
+		, "GetModuleByName", &ModuleManager::GetModuleByName
+		, "SetMigrateThreshold", &ModuleManager::SetMigrateThreshold
+		, "GetMigrateCount", &ModuleManager::GetMigrateCount
+		, "SetTurnBudget", &ModuleManager::SetTurnBudget
+		, "GetYieldCount", &ModuleManager::GetYieldCount
+		, "GetBlockingSleepCount", &ModuleManager::GetBlockingSleepCount
+		, "GetBlockingSleepTime", &ModuleManager::GetBlockingSleepTime
+		, "SetModuleStats", &ModuleManager::SetModuleStats
+		, "GetModuleStats", &ModuleManager::GetModuleStats
+		, "DumpModuleStats", &ModuleManager::DumpModuleStats
+		, "SetTraceSample", &ModuleManager::SetTraceSample
+		, "DumpTrace", &ModuleManager::DumpTrace
+		, "DumpPlacement", &ModuleManager::DumpPlacement
 		, "Run", &ModuleManager::Run
 		, "Stop", &ModuleManager::Stop
 		);
@@ -25,6 +25,8 @@ public:
 
 	MoonNetLuaBind& BindEMessageType();
 
+	MoonNetLuaBind& BindMessage();
+
 	MoonNetLuaBind& BindNetwork();
 
 	MoonNetLuaBind& BindModule();
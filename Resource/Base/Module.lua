@@ -7,12 +7,33 @@ local BinaryReader 	= require("BinaryReader")
 
 local Module 		= class("Module",Component)
 
+-- default SendRPC timeout ms
+Module.RPCTimeout 	= 5000
+
+-- RPCHandlers value of requests sent without callback, see Await
+local AWAIT 		= true
+
+local function Resume(co, ...)
+	local ok, err = coroutine.resume(co, ...)
+	if not ok then
+		error(debug.traceback(co, err), 0)
+	end
+end
+
 function Module:ctor()
     Module.super.ctor(self)
 	self.OtherModules = {}
 	self.RPCHandlers = {}
+	-- rpc id -> coroutine in Await
+	self.RPCWaiting = {}
+	-- rpc id -> {data,userdata,err,expire}, completed before Await.
+	-- kept for Module.RPCTimeout, results nobody awaits are swept as the table grows
+	self.RPCDone = {}
+	self.RPCDoneCount = 0
+	self.RPCDoneSweep = 64
+	-- handlers suspended in Sleep
+	self.Sleeping = 0
 	self.MsgHandlers = {}
-	self.RPCIncreID = 0
 	self.gateModule = 0
     Log.Trace("ctor Module")
 end
@@ -21,19 +42,53 @@ function Module:RegisterOtherModule(name, moduleID)
 	self.OtherModules[name] = moduleID
 end
 
+-- the name registry is checked first, it is always up to date
 function Module:GetOtherModule(name)
+	local id = nativeModule:GetModuleByName(name)
+	if 0 ~= id then
+		return id
+	end
     return self.OtherModules[name]
 end
 
-function Module:_Send(recevier,data,userdata,rpc,msgtype)
- 	nativeModule:Send(recevier,data,userdata,rpc,msgtype)
+-- bind name to this module, other modules find it with GetOtherModule(name).
+-- the name is unbound when the module exits
+function Module:RegisterName(name)
+	nativeModule:RegisterName(name)
+end
+
+function Module:UnregisterName(name)
+	nativeModule:UnregisterName(name)
+end
+
+-- OnNameChanged(name,id) is called whenever name is rebound, id is 0 when unbound.
+-- returns the module bound to name now, 0 if none
+function Module:WatchName(name)
+	return nativeModule:WatchName(name)
+end
+
+function Module:UnwatchName(name)
+	nativeModule:UnwatchName(name)
+end
+
+function Module:OnNameChanged(name,id)
+	if 0 == id then
+		id = nil
+	end
+	self.OtherModules[name] = id
+end
+
+function Module:_Send(recevier,data,userdata,rpc,msgtype,priority)
+ 	nativeModule:Send(recevier,data,userdata,rpc,msgtype,priority or EMessagePriority.Normal)
 end
 
 function Module:_Broadcast(data,userdata,msgtype)
  	nativeModule:Broadcast(data,userdata,msgtype)
 end
 
-function Module:Send(receiver,data,userdata,rpc,msgtype)
+-- priority: EMessagePriority.Normal(default) EMessagePriority.High, high priority messages are handled first by the receiver.
+-- rpc responses (ModuleRPC) are always high priority
+function Module:Send(receiver,data,userdata,rpc,msgtype,priority)
 
 	userdata 	= userdata or ""
 	rpc 		= rpc or 0
@@ -44,21 +99,149 @@ function Module:Send(receiver,data,userdata,rpc,msgtype)
     	msgtype = msgtype or EMessageType.ModuleData
 	end
 
-    self:_Send(receiver,data,userdata,rpc,msgtype)
+    self:_Send(receiver,data,userdata,rpc,msgtype,priority)
 
     Log.Trace("Send receiver[%u] ,msgType[%d] rpcid [%u]",receiver,msgtype,rpc)
 end
 
-function Module:SendRPC(receiver,data,userdata,cb)
-	assert(nil ~= cb,type(cb) == "function","rpc callback must not be null")
+-- forward the payload of a received Message (see SetMessageBuffer), large payloads are shared instead of copied
+function Module:Forward(receiver,msg,userdata,rpc,msgtype)
+	userdata 	= userdata or ""
+	rpc 		= rpc or 0
+	msgtype 	= msgtype or msg:GetType()
+	nativeModule:Forward(receiver,msg,userdata,rpc,msgtype)
+end
+
+-- true: OnMessage receives a read-only Message object instead of a string, use msg:Bytes() to get the string
+function Module:SetMessageBuffer(v)
+	nativeModule:SetMessageBuffer(v)
+end
+
+-- n > 1: handle up to n queued messages per scheduling turn with one call into lua, OnMessage is still called for each
+function Module:SetMessageBatch(n)
+	nativeModule:SetMessageBatch(n)
+end
 
-	self.RPCIncreID 		= self.RPCIncreID +1
-	local 		id 			= self.RPCIncreID
-	self.RPCHandlers[id] 	= cb
+-- cb(data,userdata) is called with the reply, or cb(nil,nil,"timeout") if no reply arrives in timeoutMs.
+-- without cb, wait for the reply with Await(id).
+-- timeoutMs: default Module.RPCTimeout, 0 never times out. returns the rpc id for CancelRPC
+function Module:SendRPC(receiver,data,timeoutMs,cb,userdata)
+	assert(nil == cb or type(cb) == "function","rpc callback must be a function")
+
+	local id = nativeModule:SendRPC(receiver,data,userdata or "",timeoutMs or Module.RPCTimeout)
+	self.RPCHandlers[id] = cb or AWAIT
 
-	self:_Send(receiver,data,userdata,id,EMessageType.ModuleData)
-	
 	Log.Trace("SendRpc  rpcid[%u]", id)
+	return id
+end
+
+-- the callback is dropped and a late reply is ignored, Await returns nil,nil,"cancelled"
+function Module:CancelRPC(id)
+	self.RPCHandlers[id] = nil
+	self:_TakeRPCResult(id)
+	local co = self.RPCWaiting[id]
+	if nil ~= co then
+		self.RPCWaiting[id] = nil
+		Resume(co,nil,nil,"cancelled")
+	end
+	return nativeModule:CancelRPC(id)
+end
+
+-- wait for the reply of a SendRPC without callback, returns data,userdata or nil,nil,err.
+-- only in OnMessage and functions called with Async, other messages are handled while waiting.
+-- a reply that arrived more than Module.RPCTimeout before Await returns nil,nil,"expired"
+function Module:Await(id)
+	local done = self:_TakeRPCResult(id)
+	if nil ~= done then
+		return done[1],done[2],done[3]
+	end
+
+	local f = self.RPCHandlers[id]
+	if nil == f then
+		return nil,nil,"expired"
+	end
+	assert(f == AWAIT,"rpc is not awaitable")
+	local co,main = coroutine.running()
+	assert(not main,"Await must be called in OnMessage or Async")
+	self.RPCWaiting[id] = co
+	return coroutine.yield()
+end
+
+-- suspend the current handler for ms. woken by timerPool in Update, the wake up is rounded up
+-- to the update interval (SetUpdateInterval, default one Worker tick).
+-- with update disabled it falls back to ThreadSleep, which blocks the Worker as Sleep always did
+function Module:Sleep(ms)
+	local co,main = coroutine.running()
+	assert(not main,"Sleep must be called in OnMessage or Async")
+	if not nativeModule:IsEnableUpdate() then
+		ThreadSleep(ms)
+		return
+	end
+	timerPool:ExpiredOnce(ms,function() Resume(co) end)
+	self.Sleeping = self.Sleeping + 1
+	coroutine.yield()
+	self.Sleeping = self.Sleeping - 1
+end
+
+function Module:_CompleteRPC(rpc,data,userdata,err)
+	local f = self.RPCHandlers[rpc]
+	if nil == f then
+		return false
+	end
+	self.RPCHandlers[rpc] = nil
+
+	if f ~= AWAIT then
+		f(data,userdata,err)
+		return true
+	end
+
+	local co = self.RPCWaiting[rpc]
+	if nil == co then
+		self:_KeepRPCResult(rpc,{data,userdata,err,GetMillsecond() + Module.RPCTimeout})
+		return true
+	end
+	self.RPCWaiting[rpc] = nil
+	Resume(co,data,userdata,err)
+	return true
+end
+
+function Module:_KeepRPCResult(rpc,result)
+	if self.RPCDoneCount >= self.RPCDoneSweep then
+		local now = GetMillsecond()
+		for id,v in pairs(self.RPCDone) do
+			if v[4] <= now then
+				self.RPCDone[id] = nil
+				self.RPCDoneCount = self.RPCDoneCount - 1
+			end
+		end
+		self.RPCDoneSweep = math.max(64, self.RPCDoneCount * 2)
+	end
+	self.RPCDone[rpc] = result
+	self.RPCDoneCount = self.RPCDoneCount + 1
+end
+
+function Module:_TakeRPCResult(rpc)
+	local done = self.RPCDone[rpc]
+	if nil ~= done then
+		self.RPCDone[rpc] = nil
+		self.RPCDoneCount = self.RPCDoneCount - 1
+	end
+	return done
+end
+
+function Module:GetPendingRPC()
+	return nativeModule:GetPendingRPC()
+end
+
+-- "pending:%d;sent:%d;replied:%d;timeout:%d;cancelled:%d;late:%d;avg_us:%d;max_us:%d;"
+function Module:GetRPCStats()
+	return nativeModule:GetRPCStats()
+end
+
+-- "in:%d;out:%d;bytes_in:%d;bytes_out:%d;queue_max:%d;handle:%d;handle_ns:%d;handle_p50_ns:%d;..."
+-- empty until ModuleManager:SetModuleStats(true)
+function Module:GetStats()
+	return nativeModule:GetStats()
 end
 
 function Module:Broadcast(data,userdata,msgtype)
@@ -67,6 +250,23 @@ function Module:Broadcast(data,userdata,msgtype)
  	self:_Broadcast(data,userdata,msgtype)
 end
 
+-- topic is a number chosen by the modules, a message id works well.
+-- unlike Broadcast, only the subscribers receive the published message
+function Module:Subscribe(topic)
+	nativeModule:Subscribe(topic)
+end
+
+function Module:Unsubscribe(topic)
+	nativeModule:Unsubscribe(topic)
+end
+
+-- returns the number of subscribers that received it
+function Module:Publish(topic,data,userdata,msgtype)
+	msgtype = msgtype or EMessageType.ModuleData
+	userdata = userdata or ""
+	return nativeModule:Publish(topic,data,userdata,msgtype)
+end
+
 function Module:SendToAccount(accountID,msg)
  	msg:SetType(EMessageType.ToClient)
  	msg:SetAccountID(accountID)
@@ -84,12 +284,19 @@ function Module:RegisterMessageCB(msgID,f)
 end
 
 function Module:DispatchMessage(sender,data,userdata,rpc,msgtype)
+	if msgtype == EMessageType.ModuleNameChanged then
+		self:OnNameChanged(data,sender)
+		return true
+	end
+
+	if msgtype == EMessageType.ModuleRPCTimeout then
+		Log.Warn("Rpc[%u] to [%u] timeout", rpc, sender)
+		return self:_CompleteRPC(rpc,nil,nil,"timeout")
+	end
+
 	if msgtype == EMessageType.ModuleRPC  then
 		if rpc ~=0 then	
-			local f = self.RPCHandlers[rpc]
-			if nil ~= f then
-				f(data,userData)
-				self.RPCHandlers[rpc] = nil
+			if self:_CompleteRPC(rpc,data,userdata) then
 				Log.Trace("DispatchMessage Rpc[%u] success", rpc)
 				return true
 			end
@@ -127,6 +334,54 @@ function Module:DispatchMessage(sender,data,userdata,rpc,msgtype)
 	return true
 end
 
+-- ModuleManager:ReloadModule loads the luafile into a new lua state and constructs the module there.
+-- Init and Start are not called again, names, subscriptions and other native settings are kept.
+-- the old module's OnReloadSave() result is copied to the new module's OnReload(state).
+-- only booleans, numbers, strings, tables and Network objects are copied, metatables are not.
+-- a module is reloadable only if it implements OnReload, the old module keeps running untouched if it fails.
+-- once OnReload succeeded, pending rpcs of the old module fail with "reload" and handlers sleeping in it are dropped
+function Module:OnReloadSave()
+	return nil
+end
+
+function Module:OnReload(state)
+	error(string.format("module [%s] does not implement OnReload", self:GetName()))
+end
+
+function Module:_ReloadSave()
+	if self.OnReload == Module.OnReload then
+		self:OnReload()
+	end
+	return { other = self.OtherModules, gate = self.gateModule, user = self:OnReloadSave() }
+end
+
+function Module:_Reload(state)
+	self.OtherModules = state.other or {}
+	self.gateModule = state.gate or 0
+	self:OnReload(state.user)
+end
+
+function Module:_ReloadCommit()
+	if self.Sleeping > 0 then
+		Log.Warn("Module [%s] reload drops %d sleeping handlers", self:GetName(), self.Sleeping)
+	end
+	self:_FailAllRPC("reload")
+end
+
+-- every pending rpc completes with err, callbacks and Await return nil,nil,err
+function Module:_FailAllRPC(err)
+	local ids = {}
+	for id in pairs(self.RPCHandlers) do
+		ids[#ids + 1] = id
+	end
+	for _,id in ipairs(ids) do
+		nativeModule:CancelRPC(id)
+		self:_CompleteRPC(id,nil,nil,err)
+	end
+	self.RPCDone = {}
+	self.RPCDoneCount = 0
+end
+
 function Module:GetID()
 	return nativeModule:GetID()
 end
@@ -135,7 +390,11 @@ function Module:GetName()
 	return nativeModule:GetName()
 end
 
+-- falls back to the module registered as "gate"
 function Module:GetGateModule()
+	if 0 == self.gateModule then
+		return nativeModule:GetModuleByName("gate")
+	end
 	return self.gateModule
 end
 
@@ -3,11 +3,12 @@ local Component = require("Component")
 
 local Network = class("Network",Component)
 
-function Network:ctor()
+-- net: the native network of a reloaded module, see Module:OnReload
+function Network:ctor(net)
    Network.super.ctor(self)
    Network.super.SetEnableUpdate(self,true)
 
-   self.net = CreateNetwork()
+   self.net = net or CreateNetwork()
 
    Log.Trace("ctor Network")
 end
@@ -21,6 +22,12 @@ function Network:SetHandler(f)
     self.net:SetHandler(f);
 end
 
+-- 回掉参数为只读的 Message 对象，不复制数据。 用 msg:Bytes() 或 msg:ReadXXX(pos) 读取数据
+function Network:SetBufferHandler(f)
+    assert(type(f)=="function")
+    self.net:SetBufferHandler(f);
+end
+
 function Network:Listen(ip,port)
     self.net:Listen(ip, port)
 end
@@ -43,8 +50,14 @@ function Network:Destory()
     Log.Trace("Network Stop")
 end
 
-function Network:Send(sessionID, data)
-    self.net:Send(sessionID,data)
+-- priority: ESendPriority.Urgent(默认) ESendPriority.Bulk, Bulk 用于大数据, 不会阻塞 Urgent 的消息
+function Network:Send(sessionID, data, priority)
+    self.net:Send(sessionID,data,priority or ESendPriority.Urgent)
+end
+
+-- 发送 Message 的数据, 大数据直接共享不复制, 用于转发。 priority 同 Send
+function Network:SendMessage(sessionID, msg, priority)
+    self.net:SendMessage(sessionID,msg,priority or ESendPriority.Urgent)
 end
 
 -- 超时时间 单位 s
@@ -52,6 +65,33 @@ function Network:SetTimeout(timeout)
   self.net:SetTimeout(timeout)
 end
 
+-- 优雅关闭超时时间 单位 ms, Destory 时会先发送完所有连接的数据
+function Network:SetDrainTimeout(timeout)
+  self.net:SetDrainTimeout(timeout)
+end
+
+-- 连接准入控制, 各项为0表示不限制
+-- maxsessions 最大连接数, connectrate 单个IP每秒最多连接数, maxbacklog 未处理的网络消息数上限
+-- pause 为true时过载暂停accept, 否则accept后发送拒绝原因(msgID 0xFFFF)并关闭
+function Network:SetAdmission(maxsessions, connectrate, maxbacklog, pause)
+  self.net:SetAdmission(maxsessions or 0, connectrate or 0, maxbacklog or 0, pause and true or false)
+end
+
+-- 单个连接接收频率限制, 各项为0表示不限制
+-- fps 每秒最多消息数, bps 每秒最多字节数, action 超过限制时 "pause" "drop" "close"(默认)
+function Network:SetRateLimit(fps, bps, action)
+  self.net:SetRateLimit(fps or 0, bps or 0, action or "close")
+end
+
+-- 返回连接准入统计 table: sessions rejected sessionlimit connectrate backlog paused
+function Network:GetAdmissionStats()
+  local stats = string.parsekv(self.net:GetAdmissionStats())
+  for k,v in pairs(stats) do
+    stats[k] = tonumber(v)
+  end
+  return stats
+end
+
 function Network:Native()
     return self.net
 end
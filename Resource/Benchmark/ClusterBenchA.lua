@@ -0,0 +1,28 @@
+-- two process cluster throughput benchmark, run in Resource path:
+--   MooNet Benchmark/ClusterBenchB.lua
+--   MooNet Benchmark/ClusterBenchA.lua
+package.path = 'Base/?.lua;'
+
+local mgr = ModuleManager.new()
+mgr:Init("machine_id:1;worker_num:1;")
+mgr:ListenCluster("127.0.0.1","12001")
+mgr:AddClusterPeer(2,"127.0.0.1","12002")
+
+-- first module of machine 2 worker 0, see ModuleManager::CreateModule
+local echoModule = (2 << 24) | 1
+
+mgr:CreateModule(string.format(
+	[[
+	name:sender;
+	luafile:Benchmark/ClusterSender.lua;
+	target:%d;
+	count:200000;
+	window:10000;
+	size:32;
+	]], echoModule))
+
+mgr:Run()
+
+io.read()
+
+mgr:Stop()
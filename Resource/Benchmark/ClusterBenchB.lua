@@ -0,0 +1,19 @@
+-- two process cluster throughput benchmark, see ClusterBenchA.lua
+package.path = 'Base/?.lua;'
+
+local mgr = ModuleManager.new()
+mgr:Init("machine_id:2;worker_num:1;")
+mgr:ListenCluster("127.0.0.1","12002")
+mgr:AddClusterPeer(1,"127.0.0.1","12001")
+
+mgr:CreateModule(
+	[[
+	name:echo;
+	luafile:Benchmark/ClusterEcho.lua;
+	]])
+
+mgr:Run()
+
+io.read()
+
+mgr:Stop()
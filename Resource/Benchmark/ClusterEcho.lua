@@ -0,0 +1,24 @@
+package.path    = 'Base/?.lua;Benchmark/?.lua;'
+
+require("functions")
+require("Log")
+
+local Module        = require("Module")
+
+local ClusterEcho   = class("ClusterEcho", Module)
+
+function ClusterEcho:ctor()
+    ClusterEcho.super.ctor(self)
+end
+
+function ClusterEcho:Init(config)
+    local kvconfig = string.parsekv(config)
+    self:SetMessageBatch(tonumber(kvconfig.batch or "0"))
+    Log.ConsoleTrace("ClusterEcho [%u] Init", self:GetID())
+end
+
+function ClusterEcho:OnMessage(sender,data,userdata,rpcid,msgtype)
+    self:_Send(sender,data,userdata,rpcid,msgtype)
+end
+
+return ClusterEcho
@@ -0,0 +1,81 @@
+package.path    = 'Base/?.lua;Benchmark/?.lua;'
+
+require("functions")
+require("Log")
+
+local Module        = require("Module")
+
+local ClusterSender = class("ClusterSender", Module)
+
+function ClusterSender:ctor()
+    ClusterSender.super.ctor(self)
+
+    self.target     = 0
+    self.total      = 0
+    self.window     = 0
+    self.payload    = ""
+    self.sent       = 0
+    self.recv       = 0
+    self.startTime  = 0
+    self.poolStats  = nil
+end
+
+function ClusterSender:Init(config)
+    local kvconfig = string.parsekv(config)
+
+    assert(kvconfig.target,"ClusterSender target is nil!")
+
+    self.target     = tonumber(kvconfig.target)
+    self.total      = tonumber(kvconfig.count or "200000")
+    self.window     = tonumber(kvconfig.window or "10000")
+    self.payload    = string.rep("x", tonumber(kvconfig.size or "32"))
+    self:SetMessageBatch(tonumber(kvconfig.batch or "0"))
+end
+
+function ClusterSender:Update(interval)
+    -- wait for the cluster link
+    if self.startTime == 0 then
+        self.startTime = GetMillsecond() + 2000
+        return
+    end
+
+    if GetMillsecond() < self.startTime then
+        return
+    end
+
+    if not self.poolStats then
+        self.poolStats = string.parsekv(Util.GetMemoryPoolStats())
+    end
+
+    self:Fill()
+end
+
+-- keep window messages in flight
+function ClusterSender:Fill()
+    while self.sent < self.total and self.sent - self.recv < self.window do
+        self:_Send(self.target,self.payload,"",0,EMessageType.ModuleData)
+        self.sent = self.sent + 1
+    end
+end
+
+function ClusterSender:OnMessage(sender,data,userdata,rpcid,msgtype)
+    self.recv = self.recv + 1
+    if self.poolStats then
+        self:Fill()
+    end
+    if self.recv == self.total then
+        local cost = GetMillsecond() - self.startTime
+        cost = (cost > 0) and cost or 1
+        Log.ConsoleInfo("cluster bench: %d round trips of %d bytes in %d ms, %.0f msg/s",
+            self.total, string.len(self.payload), cost, self.total * 1000 / cost)
+
+        -- whole process, both directions of every round trip
+        local stats = string.parsekv(Util.GetMemoryPoolStats())
+        local msgs  = self.total * 2
+        Log.ConsoleInfo("memory pool: %.2f allocs, %.3f mallocs per message",
+            (tonumber(stats.alloc) - tonumber(self.poolStats.alloc)) / msgs,
+            (tonumber(stats.malloc) - tonumber(self.poolStats.malloc)) / msgs)
+    end
+end
+
+return ClusterSender
@@ -0,0 +1,36 @@
+-- many idle modules on one worker, run in Resource path:
+--   MooNet Benchmark/IdleBench.lua
+-- IDLE_MODULES sets the idle module count (default 10000). Every module owns
+-- a lua state, so 10000 modules need several hundred MB of memory.
+package.path = 'Base/?.lua;'
+
+local idleCount = tonumber(os.getenv("IDLE_MODULES") or "10000")
+
+local mgr = ModuleManager.new()
+mgr:Init("machine_id:1;worker_num:1;")
+
+-- first module of machine 1 worker 0, see ModuleManager::CreateModule
+local echoModule = (1 << 24) | 1
+
+mgr:CreateModule("name:echo;luafile:Benchmark/ClusterEcho.lua;")
+
+for i = 1, idleCount do
+	mgr:CreateModule("name:idle;luafile:Benchmark/IdleModule.lua;")
+end
+
+-- ping-pong latency with the idle modules on the same worker
+mgr:CreateModule(string.format(
+	[[
+	name:sender;
+	luafile:Benchmark/ClusterSender.lua;
+	target:%d;
+	count:200000;
+	window:1;
+	size:32;
+	]], echoModule))
+
+mgr:Run()
+
+io.read()
+
+mgr:Stop()
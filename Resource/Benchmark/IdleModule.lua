@@ -0,0 +1,19 @@
+package.path    = 'Base/?.lua;Benchmark/?.lua;'
+
+require("functions")
+require("Log")
+
+local Module        = require("Module")
+
+local IdleModule    = class("IdleModule", Module)
+
+function IdleModule:ctor()
+    IdleModule.super.ctor(self)
+end
+
+function IdleModule:Init(config)
+    -- no messages, no Update: the worker should never touch this module
+    nativeModule:SetEnableUpdate(false)
+end
+
+return IdleModule
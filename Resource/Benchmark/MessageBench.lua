@@ -0,0 +1,31 @@
+-- module to module message throughput and allocations on one machine, run in Resource path:
+--   MooNet Benchmark/MessageBench.lua
+-- MESSAGE_BATCH=n lets both modules handle up to n messages per lua call, see Module:SetMessageBatch
+package.path = 'Base/?.lua;'
+
+local batch = tonumber(os.getenv("MESSAGE_BATCH") or "0")
+
+local mgr = ModuleManager.new()
+mgr:Init("machine_id:1;worker_num:2;migrate_threshold:0;")
+
+-- first module of machine 1, see ModuleManager::CreateModule
+local echoModule = (1 << 24) | 1
+
+mgr:CreateModule(string.format("name:echo;luafile:Benchmark/ClusterEcho.lua;batch:%d;", batch))
+
+mgr:CreateModule(string.format(
+	[[
+	name:sender;
+	luafile:Benchmark/ClusterSender.lua;
+	target:%d;
+	count:1000000;
+	window:100;
+	size:20;
+	batch:%d;
+	]], echoModule, batch))
+
+mgr:Run()
+
+io.read()
+
+mgr:Stop()
@@ -48,7 +48,25 @@ function Gate:Init(config)
     self.net:Init(tonumber(kvconfig.netthread))
     self.net:Listen(kvconfig.ip,kvconfig.port)
     self.net:SetHandler(handler(self,self.OnNetMessage))
-    
+    self.net:SetDrainTimeout(tonumber(kvconfig.draintimeout or "0"))
+    self.net:SetAdmission(tonumber(kvconfig.maxsessions or "0"),
+        tonumber(kvconfig.connectrate or "0"),
+        tonumber(kvconfig.maxbacklog or "0"),
+        kvconfig.overload == "pause")
+    self.net:SetRateLimit(tonumber(kvconfig.recvfps or "0"),
+        tonumber(kvconfig.recvbps or "0"),
+        kvconfig.ratelimit or "close")
+
+    self:AddComponents()
+
+    self:RegisterName("gate")
+    self:SetLoginModule(self:WatchName("login"))
+
+    Log.Trace("Gate Module Init: %s",config)
+
+end
+
+function Gate:AddComponents()
     Gate.super.AddComponent(self,"Network", self.net)
     Gate.super.AddComponent(self,"Connects", Connects.new())
     Gate.super.AddComponent(self,"GateHandler", GateHandler.new())
@@ -57,13 +75,53 @@ function Gate:Init(config)
 
     self.connects = Gate.super.GetComponent(self,"Connects")
     self.gateLoginHandler = Gate.super.GetComponent(self,"GateLoginHandler")
+end
 
-    Log.Trace("Gate Module Init: %s",config)
+-- the listening network, connections and login requests survive ModuleManager:ReloadModule.
+-- the name and the watch of "login" are kept natively
+function Gate:OnReloadSave()
+    local logins = self:GetComponent("LoginDatas")
+    return {
+        net = self.net.net,
+        connections = self.connects.connections,
+        accounts = self.connects.accounts,
+        players = self.connects.players,
+        serialNum = logins.LoginIncreSerialNum,
+        logindatas = logins.logindatas,
+        sessions = logins.sessions,
+        worldModule = self.worldModule,
+        loginModule = self.loginModule,
+    }
+end
+
+function Gate:OnReload(state)
+    self.ID = Gate.super.GetID(self)
+    Gate.super.SetGateModule(self,self.ID)
+
+    -- the network is already running, only the handler is set again
+    self.net = Network.new(state.net)
+    self.net:SetHandler(handler(self,self.OnNetMessage))
+
+    self:AddComponents()
+
+    self.connects.connections = state.connections or {}
+    self.connects.accounts = state.accounts or {}
+    self.connects.players = state.players or {}
 
+    local logins = self:GetComponent("LoginDatas")
+    logins.LoginIncreSerialNum = state.serialNum or 0
+    logins.logindatas = state.logindatas or {}
+    logins.sessions = state.sessions or {}
+
+    self.worldModule = state.worldModule
+    self:SetLoginModule(state.loginModule or 0)
+
+    self.gateLoginHandler:Start()
 end
 
+-- network messages are handled in a coroutine too, so handlers can Await
 function Gate:OnNetMessage(sessionid,data,msgtype)
-    self:OnMessage(sessionid,data,"",0,msgtype)
+    Async(self.OnMessage,self,sessionid,data,"",0,msgtype)
 end
 
 function Gate:OnMessage(sender,data,userdata,rpcid,msgtype)
@@ -73,7 +131,10 @@ function Gate:OnMessage(sender,data,userdata,rpcid,msgtype)
         self:ClientData(sender,data,msgtype)
     elseif msgtype == EMessageType.NetworkClose then
         self:ClientClose(sender,data)
-    elseif msgtype == EMessageType.ModuleData or msgtype == EMessageType.ModuleRPC then
+    elseif msgtype == EMessageType.NetworkDrain then
+        Log.ConsoleTrace("Gate network draining")
+    elseif msgtype == EMessageType.ModuleData or msgtype == EMessageType.ModuleRPC or msgtype == EMessageType.ModuleRPCTimeout
+        or msgtype == EMessageType.ModuleNameChanged then
         self:ModuleData(sender,data,userdata,rpcid,msgtype)
     elseif msgtype == EMessageType.ToClient then
         self:ToClientData(data,userdata)
@@ -158,9 +219,9 @@ function Gate:ToClientData(data,userdata)
     self.net:Send(sessionID,data)
 end
 
-function  Gate:SendNetMessage(sessionID,data)
+function  Gate:SendNetMessage(sessionID,data,priority)
     Log.Trace("send to client %u, data len %d",sessionID,string.len(data))
-    self.net:Send(sessionID,data)
+    self.net:Send(sessionID,data,priority)
 end
 
 function Gate:SetWorldModule(moduleid)
@@ -180,4 +241,12 @@ function Gate:GetLoginModule()
     return self.loginModule
 end
 
+function Gate:OnNameChanged(name,id)
+    Gate.super.OnNameChanged(self,name,id)
+    if name == "login" then
+        Log.ConsoleTrace("Gate: login module changed to %u",id)
+        self:SetLoginModule(id)
+    end
+end
+
 return Gate
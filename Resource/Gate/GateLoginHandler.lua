@@ -51,8 +51,8 @@ function GateLoginHandler:OnClientClose(account, player)
 	sm:WriteUInt64(account)
 	sm:WriteUInt64(player)
 
-
-	thisModule:Broadcast(sm:Bytes())
+	-- only the modules keeping client state subscribe to it
+	thisModule:Publish(MsgID.MSG_S2S_CLIENT_CLOSE,sm:Bytes())
 
 	self.connects:RemoveByAccount(account)
 end
@@ -84,41 +84,48 @@ function GateLoginHandler:OnRequestLogin(uctx,data,rpc)
 
 	assert(thisModule:GetLoginModule() ~= 0, "can not find login module")
 
-	thisModule:SendRPC(thisModule:GetLoginModule(),sm:Bytes(),"",  function (data,userdata)
-		Log.Trace("3.login receive echo accountID[%u] ", accountID);
-		local ld = self.loginDatas:Find(serialNum)
-		if nil == ld then
-			Log.Warn("3.login receive echo accountID[%u], can not find logindatas", accountID);
-			return
-		end
-	
-		local br = BinaryReader.new(data)
-		local loginret = br:ReadString()
-		local sn = br:ReadUInt64()
-		local act = br:ReadUInt64()
+	local rpcid = thisModule:SendRPC(thisModule:GetLoginModule(),sm:Bytes())
+	local data,userdata,err = thisModule:Await(rpcid)
+	if nil ~= err then
+		Log.Warn("3.login request accountID[%u] failed: %s", accountID, err);
+		self.loginDatas:Remove(serialNum)
+		thisModule:SendNetMessage(sessionID,Serialize(MsgID.MSG_S2C_LOGIN_RESULT,"NetMessage.S2CLogin",{ ret = err,accountID = accountID }))
+		return
+	end
 
+	Log.Trace("3.login receive echo accountID[%u] ", accountID);
+	local ld = self.loginDatas:Find(serialNum)
+	if nil == ld then
+		Log.Warn("3.login receive echo accountID[%u], can not find logindatas", accountID);
+		return
+	end
 
-		assert(serialNum == sn and  accountID == act,"login check")
+	local br = BinaryReader.new(data)
+	local loginret = br:ReadString()
+	local sn = br:ReadUInt64()
+	local act = br:ReadUInt64()
 
-		if loginret == "Ok" then
 
-			Log.Trace("4.login find login data accountID[%u] ", act);
+	assert(serialNum == sn and  accountID == act,"login check")
 
-			self.connects:SetAccount(ld.sessionID, act)
+	if loginret == "Ok" then
 
-			Log.Trace("5.login add Connection data sessionID:%u accountID%u]  ", ld.sessionID, act);
-			Log.Trace("6.login success [accountID %u]  ", act);
-		end
+		Log.Trace("4.login find login data accountID[%u] ", act);
 
-		local s2clogin = { ret = loginret,accountID = act }
-		local s2cmsg = Serialize(MsgID.MSG_S2C_LOGIN_RESULT,"NetMessage.S2CLogin",s2clogin)
+		self.connects:SetAccount(ld.sessionID, act)
 
-		thisModule:SendNetMessage(sessionID,s2cmsg)
+		Log.Trace("5.login add Connection data sessionID:%u accountID%u]  ", ld.sessionID, act);
+		Log.Trace("6.login success [accountID %u]  ", act);
+	end
+
+	local s2clogin = { ret = loginret,accountID = act }
+	local s2cmsg = Serialize(MsgID.MSG_S2C_LOGIN_RESULT,"NetMessage.S2CLogin",s2clogin)
 
-		if self.loginDatas:Remove(serialNum) then
-			Log.Trace("7.login remove login data [%u] success", serialNum);
-		end
-	end )
+	thisModule:SendNetMessage(sessionID,s2cmsg)
+
+	if self.loginDatas:Remove(serialNum) then
+		Log.Trace("7.login remove login data [%u] success", serialNum);
+	end
 end
 
 function GateLoginHandler:OnSetPlayerID(uctx,data,rpc)
@@ -3,6 +3,7 @@ package.path 	= 'Base/?.lua;Login/?.lua;'
 require("functions")
 
 local protobuf          = require("protobuf")
+local MsgID             = require("MsgID")
 local Module            = require("Module")
 local AccountDatas  	= require("AccountDatas")
 local LoginHandler 		= require("LoginHandler")
@@ -18,9 +19,27 @@ function Login:ctor()
 end
 
 function Login:Init(config)
+	self:AddComponents()
+	self:RegisterName("login")
+	self:Subscribe(MsgID.MSG_S2S_CLIENT_CLOSE)
+	Log.Trace("Module Init: %s",config)
+end
+
+function Login:AddComponents()
 	Login.super.AddComponent(self, "AccountDatas",AccountDatas.new())
 	Login.super.AddComponent(self,"LoginHandler",LoginHandler.new())
-	Log.Trace("Module Init: %s",config)
+end
+
+-- accounts survive ModuleManager:ReloadModule, the name and the subscription are kept natively
+function Login:OnReloadSave()
+	return { accounts = self:GetComponent("AccountDatas").accounts, worldModule = self.worldModule }
+end
+
+function Login:OnReload(state)
+	self:AddComponents()
+	self:GetComponent("AccountDatas").accounts = state.accounts or {}
+	self.worldModule = state.worldModule
+	Login.super.Start(self)
 end
 
 function Login:OnMessage(sender,data,userdata,rpcid,msgtype)
@@ -13,6 +13,14 @@ mgr:CreateModule(
 	netthread:1;
 	ip:127.0.0.1;
 	port:11111;
+	draintimeout:5000;
+	maxsessions:10000;
+	connectrate:50;
+	maxbacklog:800;
+	overload:pause;
+	recvfps:200;
+	recvbps:262144;
+	ratelimit:pause;
 	]])
 
 mgr:CreateModule(
@@ -25,6 +33,35 @@ mgr:Broadcast(0,UInt16ToBytes(MsgID.MSG_S2S_SERVER_START),"",EMessageType.Module
 
 mgr:Run()
 
-local name = io.read()
+-- reload <moduleID or name>: load the module's lua files again
+-- stats on|off: start or stop collecting module statistics, stats: print them
+-- trace <n>: trace one of every n client messages, 0 stops. trace dump <file>: write chrome trace json
+-- placement: print the modules of each worker
+-- any other line stops the server, as before
+while true do
+	local line = io.read()
+	if nil == line then
+		break
+	end
+	local target = string.match(line, "^reload%s+(%S+)")
+	local stats = string.match(line, "^stats%s*(%a*)$")
+	local file = string.match(line, "^trace%s+dump%s+(%S+)")
+	local sample = string.match(line, "^trace%s+(%d+)")
+	if nil ~= target then
+		mgr:ReloadModule(tonumber(target) or mgr:GetModuleByName(target))
+	elseif stats == "on" or stats == "off" then
+		mgr:SetModuleStats(stats == "on")
+	elseif stats == "" then
+		mgr:DumpModuleStats()
+	elseif nil ~= file then
+		mgr:DumpTrace(file)
+	elseif nil ~= sample then
+		mgr:SetTraceSample(tonumber(sample))
+	elseif line == "placement" then
+		mgr:DumpPlacement()
+	else
+		break
+	end
+end
 
 mgr:Stop()